@@ -0,0 +1,184 @@
+#ifndef BINDLESS_TABLE_HPP
+#define BINDLESS_TABLE_HPP
+#include <algorithm>
+#include <array>
+#include <mutex>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * BindlessTable is one descriptor set with a big array of storage buffers(binding 0)
+ * and a big array of combined image samplers(binding 1), needs VK_EXT_descriptor_indexing.
+ *
+ * AddBuffer()/AddImage() write the resource into the next free slot and return its index.
+ * Shaders index the arrays with it, usually from a push constant, so the set is bound once
+ * per command buffer and draws never bind descriptor sets.
+ *
+ * Both bindings are UPDATE_AFTER_BIND and PARTIALLY_BOUND: slots which were never written are fine as long as
+ * shaders don't read them, and new slots can be written while command buffers using the set are pending.
+ * Slots are never freed or rewritten, so a pending command buffer never sees a slot change under it.
+ *
+ * Check Supported() before creating the logic device, and enable the features it checked.
+ * Array sizes are clamped to the device's UPDATE_AFTER_BIND limits by Clamp(), shaders get the buffer array size
+ * as specialization constant 0, see BufferCountConstant.
+ */
+class BindlessTable {
+ public:
+    // the most we ask for, Clamp() may give less
+    static constexpr uint32_t MaxBuffers = 1024;
+    static constexpr uint32_t MaxImages = 1024;
+    // constant_id of the buffer array size in shaders
+    static constexpr uint32_t BufferCountConstant = 0;
+
+    struct Sizes {
+        uint32_t buffers = 0;
+        uint32_t images = 0;
+    };
+
+    // both bindings are seen by vertex and fragment stage, so each stage must hold all of them
+    static Sizes Clamp(const VkPhysicalDeviceDescriptorIndexingPropertiesEXT& limits) {
+        Sizes sizes;
+        sizes.buffers = std::min({MaxBuffers,
+                                  limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                                  limits.maxDescriptorSetUpdateAfterBindStorageBuffers});
+        sizes.images = std::min({MaxImages,
+                                 limits.maxPerStageDescriptorUpdateAfterBindSamplers,
+                                 limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                 limits.maxDescriptorSetUpdateAfterBindSamplers,
+                                 limits.maxDescriptorSetUpdateAfterBindSampledImages});
+        // buffers and images share maxPerStageUpdateAfterBindResources, split it in half if both don't fit
+        uint32_t resources = limits.maxPerStageUpdateAfterBindResources;
+        if (sizes.buffers + sizes.images > resources) {
+            sizes.buffers = std::min(sizes.buffers, resources / 2);
+            sizes.images = std::min(sizes.images, resources - sizes.buffers);
+        }
+        return sizes;
+    }
+
+    static bool Supported(const VkPhysicalDeviceFeatures& features, const VkPhysicalDeviceDescriptorIndexingFeaturesEXT& indexing) {
+        return features.shaderStorageBufferArrayDynamicIndexing &&
+               features.shaderSampledImageArrayDynamicIndexing &&
+               indexing.descriptorBindingStorageBufferUpdateAfterBind &&
+               indexing.descriptorBindingSampledImageUpdateAfterBind &&
+               indexing.descriptorBindingUpdateUnusedWhilePending &&
+               indexing.descriptorBindingPartiallyBound;
+    }
+
+    // sizes come from Clamp()
+    void Init(VkDevice device, Sizes sizes) {
+        device_ = device;
+        sizes_ = sizes;
+
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+        bindings[0].binding = 0;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[0].descriptorCount = sizes_.buffers;
+        bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[1].binding = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[1].descriptorCount = sizes_.images;
+        bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorBindingFlagsEXT flags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT|
+                                            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT|
+                                            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+        std::array<VkDescriptorBindingFlagsEXT, 2> binding_flags = {flags, flags};
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flags_info = {};
+        flags_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+        flags_info.bindingCount = binding_flags.size();
+        flags_info.pBindingFlags = binding_flags.data();
+
+        // binding flags can't be given to DescriptorLayoutCache, so the table owns its layout
+        VkDescriptorSetLayoutCreateInfo layout_info = {};
+        layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layout_info.pNext = &flags_info;
+        layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+        layout_info.bindingCount = bindings.size();
+        layout_info.pBindings = bindings.data();
+        assertm("can't create bindless descriptor set layout", vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, &layout_) == VK_SUCCESS);
+
+        std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
+        pool_sizes[0] = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, sizes_.buffers};
+        pool_sizes[1] = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, sizes_.images};
+        VkDescriptorPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+        pool_info.maxSets = 1;
+        pool_info.poolSizeCount = pool_sizes.size();
+        pool_info.pPoolSizes = pool_sizes.data();
+        assertm("can't create bindless descriptor pool", vkCreateDescriptorPool(device_, &pool_info, nullptr, &pool_) == VK_SUCCESS);
+
+        VkDescriptorSetAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.descriptorPool = pool_;
+        allocate_info.descriptorSetCount = 1;
+        allocate_info.pSetLayouts = &layout_;
+        assertm("can't allocate bindless descriptor set", vkAllocateDescriptorSets(device_, &allocate_info, &set_) == VK_SUCCESS);
+        Log("bindless table: %u buffers, %u images", sizes_.buffers, sizes_.images);
+    }
+
+    // buffer needs STORAGE_BUFFER usage, returns its index in binding 0
+    uint32_t AddBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assertm("bindless table is full of buffers", buffer_count_ < sizes_.buffers);
+        VkDescriptorBufferInfo buffer_info = {buffer, offset, range};
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set_;
+        write.dstBinding = 0;
+        write.dstArrayElement = buffer_count_;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.pBufferInfo = &buffer_info;
+        vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+        return buffer_count_++;
+    }
+
+    // returns its index in binding 1
+    uint32_t AddImage(VkImageView view, VkSampler sampler, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assertm("bindless table is full of images", image_count_ < sizes_.images);
+        VkDescriptorImageInfo image_info = {sampler, view, layout};
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set_;
+        write.dstBinding = 1;
+        write.dstArrayElement = image_count_;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.pImageInfo = &image_info;
+        vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+        return image_count_++;
+    }
+
+    Sizes Capacity() const {
+        return sizes_;
+    }
+
+    VkDescriptorSetLayout Layout() const {
+        return layout_;
+    }
+
+    VkDescriptorSet Set() const {
+        return set_;
+    }
+
+    void Destroy() {
+        vkDestroyDescriptorPool(device_, pool_, nullptr);
+        vkDestroyDescriptorSetLayout(device_, layout_, nullptr);
+    }
+
+ private:
+    VkDevice device_ = VK_NULL_HANDLE;
+    std::mutex mutex_;
+    Sizes sizes_;
+    VkDescriptorSetLayout layout_ = VK_NULL_HANDLE;
+    VkDescriptorPool pool_ = VK_NULL_HANDLE;
+    VkDescriptorSet set_ = VK_NULL_HANDLE;
+    uint32_t buffer_count_ = 0;
+    uint32_t image_count_ = 0;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef CPU_PROFILER_HPP
+#define CPU_PROFILER_HPP
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "log.hpp"
+
+/*
+ * CpuProfiler records named zones(begin and end time of a C++ scope) and exports them
+ * as Chrome trace_event JSON, open it in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Each thread writes into its own ring buffer, so recording a zone takes no lock:
+ * two clock reads, one store and one atomic add. The lock is only taken the first time
+ * a thread records, to register its buffer. When a ring is full the oldest zones are overwritten.
+ *
+ * Zone names must live forever(string literals or __FUNCTION__), only the pointer is stored.
+ *
+ * Export while other threads are still recording may see half written zones,
+ * so export after joining them. If a path is given to Enable(), the trace is written at exit.
+ */
+class CpuProfiler {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    static CpuProfiler& Get() {
+        static CpuProfiler profiler;
+        return profiler;
+    }
+
+    ~CpuProfiler() {
+        if (!output_.empty()) {
+            ExportChromeTrace(output_);
+        }
+    }
+
+    // output: write the trace to this file at exit, empty means don't write
+    void Enable(const std::string& output = "") {
+        output_ = output;
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+
+    bool Enabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t NowNs() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+    }
+
+    void Record(const char* name, uint64_t begin_ns, uint64_t end_ns) {
+        ThreadBuffer* buffer = threadBuffer();
+        uint64_t count = buffer->count.load(std::memory_order_relaxed);
+        buffer->zones.at(count % ThreadBuffer::Capacity) = Zone{name, begin_ns, end_ns};
+        buffer->count.store(count + 1, std::memory_order_release);
+    }
+
+    bool ExportChromeTrace(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "w");
+        if (!file) {
+            Log("can't open %s", path.c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t zone_count = 0;
+        fprintf(file, "{\"traceEvents\":[\n");
+        for (auto& buffer: buffers_) {
+            uint64_t count = buffer->count.load(std::memory_order_acquire);
+            uint64_t first = count > ThreadBuffer::Capacity ? count - ThreadBuffer::Capacity : 0;
+            for (uint64_t i = first; i < count; i++) {
+                const Zone& zone = buffer->zones.at(i % ThreadBuffer::Capacity);
+                // "X" is a complete event, time is in microseconds
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        zone_count == 0 ? "" : ",\n", zone.name, buffer->thread_id,
+                        zone.begin_ns / 1000.0, (zone.end_ns - zone.begin_ns) / 1000.0);
+                zone_count++;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        Log("cpu profiler: %zu zones of %zu threads written to %s", zone_count, buffers_.size(), path.c_str());
+        return true;
+    }
+
+ private:
+    struct Zone {
+        const char* name;
+        uint64_t begin_ns;
+        uint64_t end_ns;
+    };
+
+    struct ThreadBuffer {
+        static constexpr size_t Capacity = 64 * 1024;
+
+        std::array<Zone, Capacity> zones;
+        std::atomic<uint64_t> count{0};
+        uint32_t thread_id = 0;
+    };
+
+    std::atomic<bool> enabled_{false};
+    Clock::time_point start_ = Clock::now();
+    std::string output_;
+    std::mutex mutex_;
+    // owned here instead of by thread_local, so zones of finished threads can still be exported
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+
+    // statics are destroyed in reverse order, create logger first so it still works when we export at exit
+    CpuProfiler() {
+        Logger::Get();
+    }
+
+    ThreadBuffer* threadBuffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            buffers_.push_back(std::make_unique<ThreadBuffer>());
+            buffer = buffers_.back().get();
+            buffer->thread_id = static_cast<uint32_t>(buffers_.size());
+        }
+        return buffer;
+    }
+};
+
+// records the time from its construction to its destruction
+class CpuZone {
+ public:
+    explicit CpuZone(const char* name): name_(name) {
+        if (CpuProfiler::Get().Enabled()) {
+            begin_ns_ = CpuProfiler::Get().NowNs();
+            active_ = true;
+        }
+    }
+
+    ~CpuZone() {
+        if (active_) {
+            CpuProfiler::Get().Record(name_, begin_ns_, CpuProfiler::Get().NowNs());
+        }
+    }
+
+ private:
+    const char* name_;
+    uint64_t begin_ns_ = 0;
+    bool active_ = false;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_ZONE(name) CpuZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__FUNCTION__)
+
+#endif
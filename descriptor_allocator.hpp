@@ -0,0 +1,224 @@
+#ifndef DESCRIPTOR_ALLOCATOR_HPP
+#define DESCRIPTOR_ALLOCATOR_HPP
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * DescriptorLayoutCache creates one VkDescriptorSetLayout for each different list of bindings.
+ *
+ * Bindings are sorted by binding number and hashed, so asking for the same bindings in another order
+ * gives the same layout. A hash collision is checked by comparing the bindings, so it never gives a wrong layout.
+ * Layouts are owned by the cache, destroy them with Destroy() only.
+ *
+ * DescriptorAllocator hands out descriptor sets which live for one frame.
+ *
+ * Every frame in flight has its own list of pools. Allocate() takes sets from the frame's current pool,
+ * when it is full the next pool is taken, or a new one is created, so allocating never fails because a pool
+ * is exhausted. Without VK_KHR_maintenance1 a full pool may also return VK_ERROR_OUT_OF_HOST_MEMORY or
+ * VK_ERROR_OUT_OF_DEVICE_MEMORY, so they mean "pool is full" too. If a new empty pool fails as well,
+ * it is a real error.
+ * Reset() resets all pools of the frame with vkResetDescriptorPool after its fence was signaled,
+ * they are reused from the first one again, so after a few frames no pool is created any more.
+ *
+ * Both can be used from several threads at the same time.
+ */
+class DescriptorLayoutCache {
+ public:
+    void Init(VkDevice device) {
+        device_ = device;
+    }
+
+    VkDescriptorSetLayout Get(std::vector<VkDescriptorSetLayoutBinding> bindings) {
+        std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) {
+            return a.binding < b.binding;
+        });
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entries = layouts_[hashBindings(bindings)];
+        for (auto& entry: entries) {
+            if (sameBindings(entry.bindings, bindings)) {
+                return entry.layout;
+            }
+        }
+
+        VkDescriptorSetLayoutCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        create_info.bindingCount = bindings.size();
+        create_info.pBindings = bindings.data();
+        VkDescriptorSetLayout layout;
+        assertm("can't create descriptor set layout", vkCreateDescriptorSetLayout(device_, &create_info, nullptr, &layout) == VK_SUCCESS);
+        entries.push_back({bindings, layout});
+        count_++;
+        LogDebug("descriptor set layout %zu created, %zu bindings", count_, bindings.size());
+        return layout;
+    }
+
+    size_t LayoutCount() const {
+        return count_;
+    }
+
+    void Destroy() {
+        for (auto& [hash, entries]: layouts_) {
+            for (auto& entry: entries) {
+                vkDestroyDescriptorSetLayout(device_, entry.layout, nullptr);
+            }
+        }
+        layouts_.clear();
+        count_ = 0;
+    }
+
+ private:
+    struct Entry {
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        VkDescriptorSetLayout layout;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, std::vector<Entry>> layouts_;  // entries with the same hash
+    size_t count_ = 0;
+
+    // FNV-1a over the fields, immutable samplers are compared by pointer
+    static uint64_t hashBindings(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](uint64_t value) {
+            hash ^= value;
+            hash *= 1099511628211ull;
+        };
+        for (auto& binding: bindings) {
+            mix(binding.binding);
+            mix(binding.descriptorType);
+            mix(binding.descriptorCount);
+            mix(binding.stageFlags);
+            mix(reinterpret_cast<uintptr_t>(binding.pImmutableSamplers));
+        }
+        return hash;
+    }
+
+    static bool sameBindings(const std::vector<VkDescriptorSetLayoutBinding>& a, const std::vector<VkDescriptorSetLayoutBinding>& b) {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const VkDescriptorSetLayoutBinding& x, const VkDescriptorSetLayoutBinding& y) {
+            return x.binding == y.binding && x.descriptorType == y.descriptorType && x.descriptorCount == y.descriptorCount &&
+                   x.stageFlags == y.stageFlags && x.pImmutableSamplers == y.pImmutableSamplers;
+        });
+    }
+};
+
+class DescriptorAllocator {
+ public:
+    static constexpr uint32_t SetsPerPool = 256;
+
+    void Init(VkDevice device, uint32_t frame_count) {
+        device_ = device;
+        frames_.resize(frame_count);
+    }
+
+    // only call it after GPU finished the frame which used these sets last time
+    void Reset(uint32_t frame_idx) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Frame& frame = frames_.at(frame_idx);
+        for (uint32_t i = 0; i <= frame.current && i < frame.pools.size(); i++) {
+            assertm("reset descriptor pool failed", vkResetDescriptorPool(device_, frame.pools.at(i), 0) == VK_SUCCESS);
+        }
+        frame.current = 0;
+    }
+
+    // the set is valid untill Reset() of the same frame
+    VkDescriptorSet Allocate(uint32_t frame_idx, VkDescriptorSetLayout layout) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Frame& frame = frames_.at(frame_idx);
+        if (frame.pools.empty()) {
+            frame.pools.push_back(createPool());
+        }
+
+        VkDescriptorSetAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.descriptorSetCount = 1;
+        allocate_info.pSetLayouts = &layout;
+
+        VkDescriptorSet set;
+        bool empty_pool = false;
+        while (true) {
+            allocate_info.descriptorPool = frame.pools.at(frame.current);
+            VkResult result = vkAllocateDescriptorSets(device_, &allocate_info, &set);
+            if (result == VK_SUCCESS) {
+                return set;
+            }
+            // pool is full, go on with the next one
+            assertm("allocate descriptor set failed", poolFull(result));
+            assertm("descriptor set is too big for an empty pool", !empty_pool);
+            // pools after current are always empty, they were reset or just created
+            frame.current++;
+            if (frame.current == frame.pools.size()) {
+                frame.pools.push_back(createPool());
+            }
+            empty_pool = true;
+        }
+    }
+
+    size_t PoolCount() const {
+        return pool_count_;
+    }
+
+    void Destroy() {
+        for (auto& frame: frames_) {
+            for (auto& pool: frame.pools) {
+                vkDestroyDescriptorPool(device_, pool, nullptr);
+            }
+        }
+        frames_.clear();
+    }
+
+ private:
+    struct Frame {
+        std::vector<VkDescriptorPool> pools;
+        uint32_t current = 0;   // pools before it are full
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    std::mutex mutex_;
+    std::vector<Frame> frames_;
+    size_t pool_count_ = 0;
+
+    // Vulkan 1.0 without maintenance1 has no OUT_OF_POOL_MEMORY, drivers return OUT_OF_*_MEMORY for a full pool
+    static bool poolFull(VkResult result) {
+        return result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL ||
+               result == VK_ERROR_OUT_OF_HOST_MEMORY || result == VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    // how many descriptors of each type a pool has for each set
+    VkDescriptorPool createPool() {
+        constexpr std::array<std::pair<VkDescriptorType, uint32_t>, 5> PerSet = {{
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+        }};
+        std::array<VkDescriptorPoolSize, PerSet.size()> sizes;
+        for (size_t i = 0; i < PerSet.size(); i++) {
+            sizes[i].type = PerSet[i].first;
+            sizes[i].descriptorCount = PerSet[i].second * SetsPerPool;
+        }
+
+        VkDescriptorPoolCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        create_info.maxSets = SetsPerPool;
+        create_info.poolSizeCount = sizes.size();
+        create_info.pPoolSizes = sizes.data();
+        VkDescriptorPool pool;
+        assertm("create descriptor pool failed", vkCreateDescriptorPool(device_, &create_info, nullptr, &pool) == VK_SUCCESS);
+        pool_count_++;
+        LogDebug("descriptor pool %zu created", pool_count_);
+        return pool;
+    }
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef DYNAMIC_UNIFORM_BUFFER_HPP
+#define DYNAMIC_UNIFORM_BUFFER_HPP
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * DynamicUniformBuffer is one HOST_VISIBLE|HOST_COHERENT uniform buffer which is mapped forever,
+ * split into one region for each frame in flight.
+ *
+ * Allocate() takes pieces of the frame's region one after another, each piece starts at a multiple of
+ * minUniformBufferOffsetAlignment, so its offset can be given to vkCmdBindDescriptorSets as a dynamic offset.
+ * Reset() starts the region from the beginning again, call it after the frame's fence was signaled.
+ *
+ * The whole buffer has only one descriptor set(UNIFORM_BUFFER_DYNAMIC at binding 0), written once in Init().
+ * Objects only change the dynamic offset when they bind it, so writing thousands of objects every frame is
+ * one stream of memcpy, no descriptor is allocated or updated.
+ */
+struct UniformSlice {
+    uint32_t offset = 0;    // dynamic offset, counted from the beginning of the buffer
+    void* data = nullptr;
+};
+
+class DynamicUniformBuffer {
+ public:
+    // buffer size needed for frame_size bytes per frame
+    static VkDeviceSize RequiredSize(VkDeviceSize frame_size, uint32_t frame_count, VkDeviceSize alignment) {
+        return alignUp(frame_size, alignment) * frame_count;
+    }
+
+    // buffer must be created with UNIFORM_BUFFER usage and RequiredSize() bytes, mapped points to its beginning.
+    // layout has one UNIFORM_BUFFER_DYNAMIC at binding 0, shaders see range bytes from each dynamic offset
+    void Init(VkDevice device, VkBuffer buffer, void* mapped, VkDeviceSize frame_size, uint32_t frame_count,
+              VkDeviceSize alignment, VkDescriptorSetLayout layout, VkDeviceSize range) {
+        device_ = device;
+        mapped_ = static_cast<char*>(mapped);
+        alignment_ = alignment;
+        frame_size_ = alignUp(frame_size, alignment);
+        heads_.assign(frame_count, 0);
+
+        VkDescriptorPoolSize pool_size = {};
+        pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        pool_size.descriptorCount = 1;
+        VkDescriptorPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.maxSets = 1;
+        pool_info.poolSizeCount = 1;
+        pool_info.pPoolSizes = &pool_size;
+        assertm("can't create uniform descriptor pool", vkCreateDescriptorPool(device_, &pool_info, nullptr, &pool_) == VK_SUCCESS);
+
+        VkDescriptorSetAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.descriptorPool = pool_;
+        allocate_info.descriptorSetCount = 1;
+        allocate_info.pSetLayouts = &layout;
+        assertm("can't allocate uniform descriptor set", vkAllocateDescriptorSets(device_, &allocate_info, &set_) == VK_SUCCESS);
+
+        // offset of the descriptor is 0, the dynamic offset moves it
+        VkDescriptorBufferInfo buffer_info = {buffer, 0, range};
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set_;
+        write.dstBinding = 0;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        write.pBufferInfo = &buffer_info;
+        vkUpdateDescriptorSets(device_, 1, &write, 0, nullptr);
+
+        Log("dynamic uniform buffer: %llu bytes per frame, alignment %llu",
+            static_cast<unsigned long long>(frame_size_), static_cast<unsigned long long>(alignment_));
+    }
+
+    // forget what was allocated for this frame, only call it after GPU finished the frame
+    void Reset(uint32_t frame_idx) {
+        heads_.at(frame_idx) = 0;
+    }
+
+    // distance between two pieces of size bytes, write arrays of objects with this stride
+    VkDeviceSize AlignedSize(VkDeviceSize size) const {
+        return alignUp(size, alignment_);
+    }
+
+    UniformSlice Allocate(uint32_t frame_idx, VkDeviceSize size) {
+        VkDeviceSize& head = heads_.at(frame_idx);
+        VkDeviceSize aligned = AlignedSize(size);
+        assertm("dynamic uniform buffer of the frame is full", head + aligned <= frame_size_);
+
+        UniformSlice slice;
+        slice.offset = static_cast<uint32_t>(frame_idx * frame_size_ + head);
+        slice.data = mapped_ + slice.offset;
+        head += aligned;
+        return slice;
+    }
+
+    VkDescriptorSet Set() const {
+        return set_;
+    }
+
+    // destroying the pool frees the set
+    void Destroy() {
+        vkDestroyDescriptorPool(device_, pool_, nullptr);
+    }
+
+ private:
+    VkDevice device_ = VK_NULL_HANDLE;
+    char* mapped_ = nullptr;
+    VkDeviceSize alignment_ = 1;
+    VkDeviceSize frame_size_ = 0;
+    std::vector<VkDeviceSize> heads_;     // bytes allocated in each frame's region
+    VkDescriptorPool pool_ = VK_NULL_HANDLE;
+    VkDescriptorSet set_ = VK_NULL_HANDLE;
+
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef FRAME_COMMAND_POOL_HPP
+#define FRAME_COMMAND_POOL_HPP
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * FrameCommandPool gives every frame in flight its own TRANSIENT command pool.
+ *
+ * Command buffers are recorded again every frame, so instead of resetting them one by one
+ * we reset the whole pool with vkResetCommandPool when the frame's fence is signaled.
+ * Resetting a pool is one call no matter how many buffers it has, and the driver can reuse
+ * the pool memory directly.
+ *
+ * Buffers got from Get() are allocated only the first time, after Reset() the same buffers
+ * are handed out again in the same order.
+ *
+ * A command pool can't be used by two threads at the same time, so for multithreaded recording
+ * every frame has one pool per thread, each thread only calls Get() with its own thread index.
+ */
+class FrameCommandPool {
+ public:
+    void Init(VkDevice device, uint32_t queue_family, uint32_t frame_count, uint32_t thread_count = 1) {
+        device_ = device;
+        thread_count_ = thread_count;
+        pools_.resize(frame_count * thread_count);
+        for (auto& pool: pools_) {
+            VkCommandPoolCreateInfo create_info = {};
+            create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            create_info.queueFamilyIndex = queue_family;
+            assertm("create frame command pool failed", vkCreateCommandPool(device_, &create_info, nullptr, &pool.pool) == VK_SUCCESS);
+        }
+    }
+
+    // reset pools of all threads of the frame,
+    // only call it after GPU finished the frame which used these pools last time
+    void Reset(uint32_t frame_idx) {
+        for (uint32_t thread = 0; thread < thread_count_; thread++) {
+            Pool& pool = getPool(frame_idx, thread);
+            assertm("reset frame command pool failed", vkResetCommandPool(device_, pool.pool, 0) == VK_SUCCESS);
+            pool.used_primary = 0;
+            pool.used_secondary = 0;
+        }
+    }
+
+    // next free command buffer of this frame and thread, it is in initial state and can be begun directly
+    VkCommandBuffer Get(uint32_t frame_idx, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY, uint32_t thread = 0) {
+        Pool& pool = getPool(frame_idx, thread);
+        bool primary = level == VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        auto& buffers = primary ? pool.primary : pool.secondary;
+        uint32_t& used = primary ? pool.used_primary : pool.used_secondary;
+
+        if (used == buffers.size()) {
+            VkCommandBufferAllocateInfo allocate_info = {};
+            allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocate_info.commandPool = pool.pool;
+            allocate_info.level = level;
+            allocate_info.commandBufferCount = 1;
+
+            VkCommandBuffer buffer;
+            assertm("allocate frame command buffer failed", vkAllocateCommandBuffers(device_, &allocate_info, &buffer) == VK_SUCCESS);
+            buffers.push_back(buffer);
+        }
+        return buffers.at(used++);
+    }
+
+    uint32_t FrameCount() const {
+        return static_cast<uint32_t>(pools_.size()) / thread_count_;
+    }
+
+    uint32_t ThreadCount() const {
+        return thread_count_;
+    }
+
+    // destroying the pool frees all its buffers
+    void Destroy() {
+        for (auto& pool: pools_) {
+            vkDestroyCommandPool(device_, pool.pool, nullptr);
+        }
+        pools_.clear();
+    }
+
+ private:
+    struct Pool {
+        VkCommandPool pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> primary;
+        std::vector<VkCommandBuffer> secondary;
+        uint32_t used_primary = 0;
+        uint32_t used_secondary = 0;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    uint32_t thread_count_ = 1;
+    std::vector<Pool> pools_;   // frame_count * thread_count, pools of one frame are together
+
+    Pool& getPool(uint32_t frame_idx, uint32_t thread) {
+        assertm("no command pool for this thread", thread < thread_count_);
+        return pools_.at(frame_idx * thread_count_ + thread);
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef FRAME_PACER_HPP
+#define FRAME_PACER_HPP
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "log.hpp"
+
+/*
+ * FramePacer decides how long the main loop waits between two frames.
+ *
+ * Uncapped:    never wait, run as fast as CPU/GPU can.
+ * TargetFPS:   sleep most of the frame, then spin the last few milliseconds, because OS sleep is not precise.
+ * PresentMode: let the swapchain present mode pace us:
+ *                  FIFO      - vkQueuePresentKHR already blocks on vsync, so don't wait on CPU
+ *                  MAILBOX   - GPU never blocks, cap to the display refresh rate to avoid drawing frames nobody sees
+ *                  IMMEDIATE - user wants the lowest latency, so don't wait
+ *
+ * Call Wait() once at the end of each loop, it records the frame time too.
+ * Report() prints the frame time percentiles, p50 shows the normal frame, p99 shows the stutter.
+ */
+enum class PaceMode {
+    Uncapped,
+    TargetFPS,
+    PresentMode,
+};
+
+// keep the same meaning as VkPresentModeKHR, so this file don't need vulkan
+enum class PresentPacing {
+    Fifo,
+    Mailbox,
+    Immediate,
+};
+
+class FramePacer {
+ public:
+    using Clock = std::chrono::steady_clock;
+    using Duration = std::chrono::duration<double>;
+
+    FramePacer(PaceMode mode = PaceMode::TargetFPS, double target_fps = 60) {
+        SetMode(mode, target_fps);
+        samples_.reserve(MaxSamples);
+    }
+
+    void SetMode(PaceMode mode, double target_fps = 60) {
+        mode_ = mode;
+        target_fps_ = target_fps > 0 ? target_fps : 60;
+        next_deadline_ = Clock::now();
+    }
+
+    void SetPresentMode(PresentPacing present, double refresh_rate) {
+        present_ = present;
+        SetMode(PaceMode::PresentMode, refresh_rate);
+    }
+
+    // spin this long before deadline instead of sleeping, bigger costs more CPU but is more precise
+    void SetSpinThreshold(double ms) {
+        spin_threshold_ = Duration(ms / 1000.0);
+    }
+
+    void Wait() {
+        if (shouldWait()) {
+            auto period = std::chrono::duration_cast<Clock::duration>(Duration(1.0 / target_fps_));
+            next_deadline_ += period;
+
+            auto now = Clock::now();
+            // we are late more than one frame, don't try to catch up, or we will render a burst of frames
+            if (next_deadline_ < now - period) {
+                next_deadline_ = now;
+            }
+            waitUntil(next_deadline_);
+        }
+
+        auto now = Clock::now();
+        if (has_last_frame_) {
+            addSample(std::chrono::duration<double, std::milli>(now - last_frame_).count());
+        }
+        last_frame_ = now;
+        has_last_frame_ = true;
+    }
+
+    // p in [0, 100]
+    double Percentile(double p) const {
+        if (samples_.empty()) {
+            return 0;
+        }
+        vector_type sorted = samples_;
+        size_t idx = std::min(sorted.size() - 1, static_cast<size_t>(p / 100.0 * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+        return sorted.at(idx);
+    }
+
+    void Report() const {
+        if (samples_.empty()) {
+            Log("frame pacer: no frame recorded");
+            return;
+        }
+        double p50 = Percentile(50), p99 = Percentile(99);
+        Log("frame pacer[%s]: %zu frames, p50 = %.3fms(%.1f fps), p99 = %.3fms, max = %.3fms",
+            modeName(), samples_.size(),
+            p50, p50 > 0 ? 1000.0 / p50 : 0.0,
+            p99, *std::max_element(samples_.begin(), samples_.end()));
+    }
+
+ private:
+    using vector_type = std::vector<double>;
+
+    // only keep recent frames, so percentiles follow what happens now
+    static constexpr size_t MaxSamples = 4096;
+
+    PaceMode mode_;
+    PresentPacing present_ = PresentPacing::Fifo;
+    double target_fps_;
+    Duration spin_threshold_ = Duration(0.002);
+    Clock::time_point next_deadline_;
+    Clock::time_point last_frame_;
+    bool has_last_frame_ = false;
+    vector_type samples_;
+    size_t sample_idx_ = 0;
+
+    bool shouldWait() const {
+        switch (mode_) {
+            case PaceMode::Uncapped:
+                return false;
+            case PaceMode::TargetFPS:
+                return true;
+            case PaceMode::PresentMode:
+                return present_ == PresentPacing::Mailbox;
+        }
+        return false;
+    }
+
+    void waitUntil(Clock::time_point deadline) {
+        auto sleep_until = deadline - std::chrono::duration_cast<Clock::duration>(spin_threshold_);
+        if (Clock::now() < sleep_until) {
+            std::this_thread::sleep_until(sleep_until);
+        }
+        while (Clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+    }
+
+    void addSample(double ms) {
+        if (samples_.size() < MaxSamples) {
+            samples_.push_back(ms);
+        } else {
+            samples_.at(sample_idx_) = ms;
+            sample_idx_ = (sample_idx_ + 1) % MaxSamples;
+        }
+    }
+
+    const char* modeName() const {
+        switch (mode_) {
+            case PaceMode::Uncapped:
+                return "uncapped";
+            case PaceMode::TargetFPS:
+                return "target fps";
+            case PaceMode::PresentMode:
+                switch (present_) {
+                    case PresentPacing::Fifo:
+                        return "present fifo";
+                    case PresentPacing::Mailbox:
+                        return "present mailbox";
+                    case PresentPacing::Immediate:
+                        return "present immediate";
+                }
+        }
+        return "unknown";
+    }
+};
+
+#endif
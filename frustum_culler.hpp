@@ -0,0 +1,148 @@
+#ifndef FRUSTUM_CULLER_HPP
+#define FRUSTUM_CULLER_HPP
+#include <array>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+
+#include "descriptor_allocator.hpp"
+#include "log.hpp"
+
+/*
+ * FrustumCuller runs a compute shader(shader/cull.comp) which tests the bounding circle of every instance
+ * against the frustum planes, and appends the visible ones to another buffer. Each append also increases
+ * instanceCount of the indirect command, so one vkCmdDrawIndexedIndirect draws exactly what survived,
+ * CPU never looks at the instances.
+ *
+ * Every frame in flight has its own buffers. Record() takes a set for them from DescriptorAllocator
+ * and writes it each frame, so the set is never one the GPU is still reading.
+ * Before Record(), the instanceCount of the indirect command must be 0.
+ *
+ * The scene is 2D, so the frustum is 4 planes(lines) in NDC, see Planes().
+ */
+class FrustumCuller {
+ public:
+    static constexpr uint32_t GroupSize = 64;     // local_size_x of cull.comp
+
+    // same layout as push constants of cull.comp
+    struct Params {
+        std::array<glm::vec4, 4> planes;
+        uint32_t count;
+    };
+
+    // the set layout is owned by layouts
+    void Init(VkDevice device, VkShaderModule module, VkPipelineCache cache, DescriptorLayoutCache& layouts, uint32_t frame_count) {
+        device_ = device;
+        frames_.resize(frame_count);
+
+        // 0: all instances, 1: visible instances, 2: indirect command
+        std::vector<VkDescriptorSetLayoutBinding> bindings(3);
+        for (uint32_t i = 0; i < bindings.size(); i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        set_layout_ = layouts.Get(bindings);
+
+        VkPushConstantRange push_range = {};
+        push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_range.offset = 0;
+        push_range.size = sizeof(Params);
+
+        VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+        pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipeline_layout_info.setLayoutCount = 1;
+        pipeline_layout_info.pSetLayouts = &set_layout_;
+        pipeline_layout_info.pushConstantRangeCount = 1;
+        pipeline_layout_info.pPushConstantRanges = &push_range;
+        assertm("can't create cull pipeline layout", vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr, &pipeline_layout_) == VK_SUCCESS);
+
+        VkComputePipelineCreateInfo pipeline_info = {};
+        pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipeline_info.stage.module = module;
+        pipeline_info.stage.pName = "main";
+        pipeline_info.layout = pipeline_layout_;
+        assertm("can't create cull pipeline", vkCreateComputePipelines(device_, cache, 1, &pipeline_info, nullptr, &pipeline_) == VK_SUCCESS);
+    }
+
+    // indirect must have the draw count at byte 0 and the command at byte 16, see cull.comp
+    void SetBuffers(uint32_t frame_idx, VkBuffer instances, VkBuffer culled, VkBuffer indirect) {
+        frames_.at(frame_idx) = {instances, culled, indirect};
+    }
+
+    // left, bottom, right, top of the visible rectangle in NDC
+    static std::array<glm::vec4, 4> Planes(float left, float bottom, float right, float top) {
+        std::array<glm::vec4, 4> planes;
+        planes[0] = {1, 0, 0, -left};
+        planes[1] = {-1, 0, 0, right};
+        planes[2] = {0, 1, 0, -bottom};
+        planes[3] = {0, -1, 0, top};
+        return planes;
+    }
+
+    // record outside render pass, the following draws can read the results at DRAW_INDIRECT and VERTEX_INPUT stages,
+    // and CPU can read the visible count after the frame's fence.
+    // descriptors must be reset for frame_idx after the frame's fence, like the command pool
+    void Record(VkCommandBuffer buffer, DescriptorAllocator& descriptors, uint32_t frame_idx, uint32_t count,
+                const std::array<glm::vec4, 4>& planes) {
+        VkDescriptorSet set = descriptors.Allocate(frame_idx, set_layout_);
+        writeSet(set, frames_.at(frame_idx));
+
+        Params params = {planes, count};
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout_, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(buffer, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Params), &params);
+        vkCmdDispatch(buffer, (count + GroupSize - 1) / GroupSize, 1, 1);
+
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT|VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT|VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(buffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT|VK_PIPELINE_STAGE_VERTEX_INPUT_BIT|VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    void Destroy() {
+        vkDestroyPipeline(device_, pipeline_, nullptr);
+        vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
+    }
+
+ private:
+    struct FrameBuffers {
+        VkBuffer instances = VK_NULL_HANDLE;
+        VkBuffer culled = VK_NULL_HANDLE;
+        VkBuffer indirect = VK_NULL_HANDLE;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkDescriptorSetLayout set_layout_ = VK_NULL_HANDLE;
+    VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+    VkPipeline pipeline_ = VK_NULL_HANDLE;
+    std::vector<FrameBuffers> frames_;
+
+    void writeSet(VkDescriptorSet set, const FrameBuffers& frame) {
+        std::array<VkDescriptorBufferInfo, 3> infos = {};
+        infos[0] = {frame.instances, 0, VK_WHOLE_SIZE};
+        infos[1] = {frame.culled, 0, VK_WHOLE_SIZE};
+        infos[2] = {frame.indirect, 0, VK_WHOLE_SIZE};
+
+        std::array<VkWriteDescriptorSet, 3> writes = {};
+        for (uint32_t i = 0; i < writes.size(); i++) {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &infos[i];
+        }
+        vkUpdateDescriptorSets(device_, writes.size(), writes.data(), 0, nullptr);
+    }
+};
+
+#endif
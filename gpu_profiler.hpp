@@ -0,0 +1,235 @@
+#ifndef GPU_PROFILER_HPP
+#define GPU_PROFILER_HPP
+#include <array>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * GpuProfiler measures GPU time with timestamp queries.
+ *
+ * Every frame in flight owns a range of MaxQueriesPerFrame queries in one VkQueryPool.
+ * Begin()/End() write a timestamp pair around the commands of a scope.
+ * Results are only read in BeginFrame() of the same frame index, which runs after the frame's fence
+ * was signaled (MaxFramesInFlight frames later), so reading never stalls.
+ *
+ * Timestamps are in ticks, timestampPeriod from VkPhysicalDeviceLimits converts them to nanoseconds,
+ * and only timestampValidBits of the queue family are meaningful.
+ *
+ * Each scope name keeps a rolling average of its recent frames, and OpenCSV() dumps
+ * every scope of every frame as "frame,scope,gpu_ms".
+ */
+class GpuProfiler {
+ public:
+    static constexpr uint32_t MaxQueriesPerFrame = 128;
+    static constexpr uint32_t InvalidScope = ~0u;
+
+    void Init(VkPhysicalDevice physical_device, VkDevice device, uint32_t queue_family, uint32_t frame_count) {
+        device_ = device;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physical_device, &properties);
+        timestamp_period_ = properties.limits.timestampPeriod;
+
+        uint32_t count;
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, nullptr);
+        std::vector<VkQueueFamilyProperties> families(count);
+        vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, families.data());
+        uint32_t valid_bits = families.at(queue_family).timestampValidBits;
+        if (valid_bits == 0) {
+            Log("gpu profiler: queue family %u don't support timestamps, disabled", queue_family);
+            return;
+        }
+        valid_mask_ = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+        VkQueryPoolCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        create_info.queryCount = MaxQueriesPerFrame * frame_count;
+        assertm("can't create timestamp query pool", vkCreateQueryPool(device_, &create_info, nullptr, &pool_) == VK_SUCCESS);
+
+        frames_.resize(frame_count);
+        Log("gpu profiler: timestamp period %.3fns, %u valid bits", timestamp_period_, valid_bits);
+    }
+
+    bool Enabled() const {
+        return pool_ != VK_NULL_HANDLE;
+    }
+
+    // call it at the beginning of the command buffer(outside render pass), after the frame's fence was signaled.
+    // it collects the results this frame index wrote last time, then resets its queries
+    void BeginFrame(uint32_t frame_idx, VkCommandBuffer buffer) {
+        if (!Enabled()) {
+            return;
+        }
+        Frame& frame = frames_.at(frame_idx);
+        if (frame.submitted) {
+            collect(frame_idx);
+        }
+        frame.scopes.clear();
+        frame.submitted = false;
+        vkCmdResetQueryPool(buffer, pool_, frame_idx * MaxQueriesPerFrame, MaxQueriesPerFrame);
+        recording_frame_ = frame_idx;
+    }
+
+    // call it after the command buffer of BeginFrame() was submitted
+    void EndFrame(uint32_t frame_idx) {
+        if (Enabled()) {
+            frames_.at(frame_idx).submitted = true;
+        }
+    }
+
+    // returns InvalidScope if the frame used up its queries, End() ignores it
+    uint32_t Begin(VkCommandBuffer buffer, const std::string& name) {
+        if (!Enabled()) {
+            return InvalidScope;
+        }
+        Frame& frame = frames_.at(recording_frame_);
+        if ((frame.scopes.size() + 1) * 2 > MaxQueriesPerFrame) {
+            return InvalidScope;
+        }
+        uint32_t scope = static_cast<uint32_t>(frame.scopes.size());
+        frame.scopes.push_back(name);
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool_, queryIdx(recording_frame_, scope * 2));
+        return scope;
+    }
+
+    void End(VkCommandBuffer buffer, uint32_t scope) {
+        if (scope == InvalidScope) {
+            return;
+        }
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool_, queryIdx(recording_frame_, scope * 2 + 1));
+    }
+
+    // average of the recent frames, 0 if the scope never finished
+    double AverageMs(const std::string& name) const {
+        auto it = averages_.find(name);
+        return it == averages_.end() ? 0.0 : it->second.Average();
+    }
+
+    void Report() const {
+        if (!Enabled() || averages_.empty()) {
+            return;
+        }
+        Log("gpu profiler: average of last %zu frames", RollingAverage::Capacity);
+        for (auto& [name, average]: averages_) {
+            Log("\t%s: %.3fms", name.c_str(), average.Average());
+        }
+    }
+
+    bool OpenCSV(const std::string& path) {
+        csv_ = fopen(path.c_str(), "w");
+        if (!csv_) {
+            Log("can't open %s", path.c_str());
+            return false;
+        }
+        fprintf(csv_, "frame,scope,gpu_ms\n");
+        return true;
+    }
+
+    void Destroy() {
+        if (csv_) {
+            fclose(csv_);
+            csv_ = nullptr;
+        }
+        if (pool_) {
+            vkDestroyQueryPool(device_, pool_, nullptr);
+            pool_ = VK_NULL_HANDLE;
+        }
+    }
+
+ private:
+    struct Frame {
+        std::vector<std::string> scopes;   // scope i uses query 2 * i and 2 * i + 1
+        bool submitted = false;
+    };
+
+    class RollingAverage {
+     public:
+        static constexpr size_t Capacity = 64;
+
+        void Add(double value) {
+            if (count_ == Capacity) {
+                sum_ -= samples_.at(next_);
+            } else {
+                count_++;
+            }
+            samples_.at(next_) = value;
+            sum_ += value;
+            next_ = (next_ + 1) % Capacity;
+        }
+
+        double Average() const {
+            return count_ == 0 ? 0.0 : sum_ / count_;
+        }
+
+     private:
+        std::array<double, Capacity> samples_ = {};
+        size_t count_ = 0;
+        size_t next_ = 0;
+        double sum_ = 0;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkQueryPool pool_ = VK_NULL_HANDLE;
+    float timestamp_period_ = 1;
+    uint64_t valid_mask_ = ~0ull;
+    std::vector<Frame> frames_;
+    uint32_t recording_frame_ = 0;
+    uint64_t collected_frames_ = 0;
+    std::map<std::string, RollingAverage> averages_;
+    FILE* csv_ = nullptr;
+
+    uint32_t queryIdx(uint32_t frame_idx, uint32_t query) const {
+        return frame_idx * MaxQueriesPerFrame + query;
+    }
+
+    void collect(uint32_t frame_idx) {
+        Frame& frame = frames_.at(frame_idx);
+        if (frame.scopes.empty()) {
+            return;
+        }
+        // the fence was signaled, so results are ready and we don't need VK_QUERY_RESULT_WAIT_BIT
+        std::vector<uint64_t> timestamps(frame.scopes.size() * 2);
+        VkResult result = vkGetQueryPoolResults(device_, pool_, queryIdx(frame_idx, 0), timestamps.size(),
+                                                timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+                                                VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS) {
+            return;
+        }
+
+        collected_frames_++;
+        for (size_t i = 0; i < frame.scopes.size(); i++) {
+            uint64_t begin = timestamps.at(i * 2) & valid_mask_;
+            uint64_t end = timestamps.at(i * 2 + 1) & valid_mask_;
+            double ms = double((end - begin) & valid_mask_) * timestamp_period_ / 1e6;
+            averages_[frame.scopes.at(i)].Add(ms);
+            if (csv_) {
+                fprintf(csv_, "%llu,%s,%.6f\n", static_cast<unsigned long long>(collected_frames_), frame.scopes.at(i).c_str(), ms);
+            }
+        }
+    }
+};
+
+// write timestamps around the commands recorded in this C++ scope
+class GpuScope {
+ public:
+    GpuScope(GpuProfiler& profiler, VkCommandBuffer buffer, const std::string& name)
+        : profiler_(profiler), buffer_(buffer), scope_(profiler.Begin(buffer, name)) {}
+
+    ~GpuScope() {
+        profiler_.End(buffer_, scope_);
+    }
+
+ private:
+    GpuProfiler& profiler_;
+    VkCommandBuffer buffer_;
+    uint32_t scope_;
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include "SDL.h"
 
 #include "log.hpp"
+#include "frame_pacer.hpp"
 
 constexpr int WindowWidth = 1024;
 constexpr int WindowHeight = 720;
@@ -40,14 +41,16 @@ class App {
     void Run() {
         while (!ShouldClose()) {
             pollEvent();
-            SDL_Delay(60);
+            pacer_.Wait();
         }
+        pacer_.Report();
     }
 
  private:
     SDL_Window* window_;
     SDL_Event event;
     bool should_close_;
+    FramePacer pacer_;
 
     void initSDL() {
         SDL_Init(SDL_INIT_EVERYTHING);
@@ -3,7 +3,6 @@
  */
 #include <string>
 #include <vector>
-#include <iostream>
 
 // include vulkan
 #include "vulkan/vulkan.hpp"
@@ -12,9 +11,8 @@
 #include "SDL_vulkan.h"
 
 #include "log.hpp"
+#include "frame_pacer.hpp"
 
-using std::cout;
-using std::endl;
 using std::vector;
 
 constexpr int WindowWidth = 1024;
@@ -47,14 +45,16 @@ class App {
     void Run() {
         while (!ShouldClose()) {
             pollEvent();
-            SDL_Delay(60);
+            pacer_.Wait();
         }
+        pacer_.Report();
     }
 
  private:
     SDL_Window* window_;
     SDL_Event event;
     bool should_close_;
+    FramePacer pacer_;
 
     void initSDL() {
         SDL_Init(SDL_INIT_EVERYTHING);
@@ -103,9 +103,9 @@ class App {
         vector<const char*> extensions(extension_count);
         SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, extensions.data());
 
-        cout << "SDL provide extensions:" << endl;
+        LogDebug("SDL provide extensions:");
         for (const char* extension: extensions) {
-            cout<< "\t" << extension << endl;
+            LogDebug("\t%s", extension);
         }
 
         VkInstanceCreateInfo instance_create_info = {};
@@ -130,9 +130,9 @@ class App {
         vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
         vector<VkExtensionProperties> properties(count);
         vkEnumerateInstanceExtensionProperties(nullptr, &count, properties.data());
-        cout << "all supported extensions:" << endl;
+        LogDebug("all supported extensions:");
         for (auto& property: properties) {
-            cout << "\t" << property.extensionName << endl;
+            LogDebug("\t%s", property.extensionName);
         }
     }
 
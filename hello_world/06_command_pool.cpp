@@ -3,7 +3,6 @@
  */
 #include <string>
 #include <vector>
-#include <iostream>
 #include <optional>
 #include <array>
 #include <set>
@@ -15,9 +14,8 @@
 #include "SDL_vulkan.h"
 
 #include "log.hpp"
+#include "frame_pacer.hpp"
 
-using std::cout;
-using std::endl;
 using std::vector;
 using std::optional;
 using std::array;
@@ -71,14 +69,16 @@ class App {
     void Run() {
         while (!ShouldClose()) {
             pollEvent();
-            SDL_Delay(60);
+            pacer_.Wait();
         }
+        pacer_.Report();
     }
 
  private:
     SDL_Window* window_;
     SDL_Event event;
     bool should_close_;
+    FramePacer pacer_;
 
     void initSDL() {
         SDL_Init(SDL_INIT_EVERYTHING);
@@ -147,9 +147,9 @@ class App {
         // NOTIC: if you don't have this extension, validation layer will not show error untill you create logic device.
         extensions.push_back("VK_KHR_get_physical_device_properties2");
 
-        cout << "SDL provide extensions:" << endl;
+        LogDebug("SDL provide extensions:");
         for (const char* extension: extensions) {
-            cout<< "\t" << extension << endl;
+            LogDebug("\t%s", extension);
         }
 
         VkInstanceCreateInfo instance_create_info = {};
@@ -205,9 +205,9 @@ class App {
         vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
         vector<VkExtensionProperties> properties(count);
         vkEnumerateInstanceExtensionProperties(nullptr, &count, properties.data());
-        cout << "all supported extensions:" << endl;
+        LogDebug("all supported extensions:");
         for (auto& property: properties) {
-            cout << "\t" << property.extensionName << endl;
+            LogDebug("\t%s", property.extensionName);
         }
     }
 
@@ -217,9 +217,9 @@ class App {
         vector<VkLayerProperties> properties(count);
         vkEnumerateInstanceLayerProperties(&count, properties.data());
 
-        cout << "all supported validation layers:" << endl;
+        LogDebug("all supported validation layers:");
         for (auto& property: properties) {
-            cout << "\t" << property.layerName << endl;
+            LogDebug("\t%s", property.layerName);
         }
     }
 
@@ -237,19 +237,17 @@ class App {
     void printPhysicalDeviceInfo(VkPhysicalDevice& device) {
         VkPhysicalDeviceProperties property;
         vkGetPhysicalDeviceProperties(physical_device_, &property);
-        cout << "physic device property:" << endl;
-        cout << "\tname: " << property.deviceName << endl;
-        cout << "\tintergrated?: " << (property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU?"YES":"NO") << endl;
-        printf("\tapi version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.apiVersion),
-                VK_VERSION_MINOR(property.apiVersion),
-                VK_VERSION_PATCH(property.apiVersion)
-                );
-        printf("\tdriver version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.driverVersion),
-                VK_VERSION_MINOR(property.driverVersion),
-                VK_VERSION_PATCH(property.driverVersion)
-                );
+        Log("physic device property:");
+        Log("\tname: %s", property.deviceName);
+        Log("\tintergrated?: %s", property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ? "YES" : "NO");
+        Log("\tapi version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.apiVersion),
+            VK_VERSION_MINOR(property.apiVersion),
+            VK_VERSION_PATCH(property.apiVersion));
+        Log("\tdriver version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.driverVersion),
+            VK_VERSION_MINOR(property.driverVersion),
+            VK_VERSION_PATCH(property.driverVersion));
     }
 
     void createSurface() {
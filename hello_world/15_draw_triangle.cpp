@@ -3,13 +3,16 @@
  */
 #include <string>
 #include <vector>
-#include <iostream>
 #include <optional>
 #include <array>
 #include <set>
 #include <streambuf>
 #include <fstream>
 #include <limits>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
 // include vulkan
 #include "vulkan/vulkan.hpp"
@@ -18,10 +21,17 @@
 #include "SDL_vulkan.h"
 
 #include "log.hpp"
+#include "frame_pacer.hpp"
+#include "offscreen_target.hpp"
 #include "vulkan/vulkan_core.h"
 
-using std::cout;
-using std::endl;
+// generated by make from shader/shader.vert and shader/shader.frag, if it is there
+// shaders come from the binary, otherwise they are loaded from shader/*.spv
+#if __has_include("shader/embedded_shaders.hpp")
+#include "shader/embedded_shaders.hpp"
+#define EMBEDDED_SHADERS
+#endif
+
 using std::vector;
 using std::optional;
 using std::string;
@@ -38,6 +48,40 @@ constexpr bool EnableValidation = true;
 constexpr bool EnableValidation = false;
 #endif
 
+// how many frames CPU can record ahead of GPU, change it by -DMAX_FRAMES_IN_FLIGHT=N
+#ifndef MAX_FRAMES_IN_FLIGHT
+#define MAX_FRAMES_IN_FLIGHT 2
+#endif
+
+constexpr int MaxFramesInFlight = MAX_FRAMES_IN_FLIGHT;
+
+// record how long CPU blocks on GPU fences, print the result once per second
+struct FrameOverlapStats {
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point report_begin = Clock::now();
+    uint32_t frame_count = 0;
+    double fence_wait_ms = 0;
+
+    void AddFrame(double wait_ms) {
+        frame_count++;
+        fence_wait_ms += wait_ms;
+
+        double elapse_ms = std::chrono::duration<double, std::milli>(Clock::now() - report_begin).count();
+        if (elapse_ms >= 1000.0) {
+            double frame_ms = elapse_ms / frame_count;
+            double wait_ms_per_frame = fence_wait_ms / frame_count;
+            // the time CPU don't wait for GPU is the time they work together
+            Log("fps: %u, cpu frame: %.3fms, wait gpu: %.3fms, overlap: %.1f%%",
+                frame_count, frame_ms, wait_ms_per_frame,
+                100.0 * (1.0 - wait_ms_per_frame / frame_ms));
+            report_begin = Clock::now();
+            frame_count = 0;
+            fence_wait_ms = 0;
+        }
+    }
+};
+
 struct QueueFamilyIdx {
     optional<uint32_t> present_queue_idx;
     optional<uint32_t> graphic_queue_idx;
@@ -57,7 +101,8 @@ string ReadShader(string filename) {
 
 class App {
  public:
-    App():should_close_(false) {
+    // headless renders into an offscreen image without window, surface or swapchain
+    App(bool headless = false):should_close_(false), headless_(headless) {
         initSDL();
         initVulkan();
     }
@@ -68,7 +113,9 @@ class App {
     }
 
     void SetTitle(std::string title) {
-        SDL_SetWindowTitle(window_, title.c_str());
+        if (window_) {
+            SDL_SetWindowTitle(window_, title.c_str());
+        }
     }
 
     void Exit() {
@@ -79,12 +126,42 @@ class App {
         return should_close_;
     }
 
+    // draw frame_count frames offscreen, print throughput, then check and save the last frame.
+    // return false if nothing is drawn at the center of the image
+    bool RunHeadless(uint32_t frame_count, const string& output) {
+        using Clock = std::chrono::steady_clock;
+        assertm("RunHeadless() needs a headless App", headless_);
+
+        auto begin = Clock::now();
+        for (uint32_t i = 0; i < frame_count; i++) {
+            drawFrame();
+            pacer_.Wait();
+        }
+        vkDeviceWaitIdle(device_);
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        pacer_.Report();
+        Log("headless: %u frames in %.3fs, %.1f fps", frame_count, seconds, frame_count / seconds);
+
+        // the corner only has clear color, the center should be covered by what we draw
+        VkExtent2D extent = offscreen_.Extent();
+        auto corner = offscreen_.Pixel(0, 0);
+        auto center = offscreen_.Pixel(extent.width / 2, extent.height / 2);
+        Log("corner pixel = (%u, %u, %u, %u), center pixel = (%u, %u, %u, %u)",
+            corner[0], corner[1], corner[2], corner[3],
+            center[0], center[1], center[2], center[3]);
+        if (offscreen_.SavePPM(output)) {
+            Log("last frame saved to %s", output.c_str());
+        }
+        return center != corner;
+    }
+
     void Run() {
         while (!ShouldClose()) {
             pollEvent();
             drawFrame();
-            SDL_Delay(60);
+            pacer_.Wait();
         }
+        pacer_.Report();
         vkDeviceWaitIdle(device_);
     }
 
@@ -92,14 +169,20 @@ class App {
     SDL_Window* window_;
     SDL_Event event;
     bool should_close_;
+    bool headless_;
+    FramePacer pacer_;
 
     void initSDL() {
+        if (headless_) {
+            window_ = nullptr;
+            return;
+        }
         SDL_Init(SDL_INIT_EVERYTHING);
         window_ = SDL_CreateWindow(
                 "",
                 SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
                 WindowWidth, WindowHeight,
-                SDL_WINDOW_SHOWN|SDL_WINDOW_VULKAN
+                SDL_WINDOW_SHOWN|SDL_WINDOW_VULKAN|SDL_WINDOW_RESIZABLE
                 );
         assertm("can't create window", window_ != nullptr);
     }
@@ -109,6 +192,9 @@ class App {
             if (event.type == SDL_QUIT) {
                 Exit();
             }
+            if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                framebuffer_resized_ = true;
+            }
         }
     }
 
@@ -120,11 +206,14 @@ class App {
     VkInstance instance_;
     VkPhysicalDevice physical_device_;
     VkSurfaceKHR surface_;
+    OffscreenTarget offscreen_;     // used instead of swapchain in headless mode
     VkDevice device_;
     VkQueue graphic_queue_;
     VkQueue present_queue_;
     VkCommandPool commandpool_;
-    VkSwapchainKHR swapchain_;
+    VkSwapchainKHR swapchain_ = VK_NULL_HANDLE;
+    VkExtent2D swapchain_extent_;
+    bool framebuffer_resized_ = false;
     vector<VkCommandBuffer> command_buffers_;
     vector<VkImage> images_;
     vector<VkImageView> imageviews_;
@@ -132,8 +221,12 @@ class App {
     VkPipelineLayout pipeline_layout_;
     VkRenderPass renderpass_;
     vector<VkFramebuffer> framebuffers_;
-    VkSemaphore image_avaliable_semaphore_;
-    VkSemaphore present_finish_semaphore_;
+    vector<VkSemaphore> image_avaliable_semaphores_;
+    vector<VkSemaphore> present_finish_semaphores_;
+    vector<VkFence> inflight_fences_;
+    vector<VkFence> images_inflight_;   // which frame's fence is using the swapchain image
+    int current_frame_ = 0;
+    FrameOverlapStats overlap_stats_;
 
     void initVulkan() {
         createInstance();
@@ -146,8 +239,15 @@ class App {
         Log("create logic device");
         createCommandPool();
         Log("create command pool");
-        createSwapchain();
-        Log("create swapchain");
+        if (headless_) {
+            createOffscreenTarget();
+            Log("create offscreen target");
+        } else {
+            createSwapchain();
+            Log("create swapchain");
+        }
+        setupFramePacer();
+        Log("setup frame pacer");
         createImageViews();
         Log("create image views");
         createRenderPass();
@@ -160,8 +260,8 @@ class App {
         Log("create command buffers");
         prepDraw();
         Log("prepared command buffer to draw");
-        createSemaphores();
-        Log("create semahpores ok");
+        createSyncObjects();
+        Log("create sync objects ok");
     }
 
     void createInstance() {
@@ -174,20 +274,23 @@ class App {
         app_info.pApplicationName = "SDL";
         app_info.pNext = nullptr;
 
-        // get SDL extensions
-        uint32_t extension_count;
-        SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, nullptr);
-        assertm("can't get extension from vulkan", extension_count != 0);
-        vector<const char*> extensions(extension_count);
-        SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, extensions.data());
+        // get SDL extensions, headless mode has no surface so don't need them
+        vector<const char*> extensions;
+        if (!headless_) {
+            uint32_t extension_count;
+            SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, nullptr);
+            assertm("can't get extension from vulkan", extension_count != 0);
+            extensions.resize(extension_count);
+            SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, extensions.data());
+        }
 
         // On MacOS, the validation layer rely on this extension, so we add it here.
         // NOTIC: if you don't have this extension, validation layer will not show error untill you create logic device.
         extensions.push_back("VK_KHR_get_physical_device_properties2");
 
-        cout << "SDL provide extensions:" << endl;
+        LogDebug("SDL provide extensions:");
         for (const char* extension: extensions) {
-            cout<< "\t" << extension << endl;
+            LogDebug("\t%s", extension);
         }
 
         VkInstanceCreateInfo instance_create_info = {};
@@ -243,9 +346,9 @@ class App {
         vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
         vector<VkExtensionProperties> properties(count);
         vkEnumerateInstanceExtensionProperties(nullptr, &count, properties.data());
-        cout << "all supported extensions:" << endl;
+        LogDebug("all supported extensions:");
         for (auto& property: properties) {
-            cout << "\t" << property.extensionName << endl;
+            LogDebug("\t%s", property.extensionName);
         }
     }
 
@@ -255,9 +358,9 @@ class App {
         vector<VkLayerProperties> properties(count);
         vkEnumerateInstanceLayerProperties(&count, properties.data());
 
-        cout << "all supported validation layers:" << endl;
+        LogDebug("all supported validation layers:");
         for (auto& property: properties) {
-            cout << "\t" << property.layerName << endl;
+            LogDebug("\t%s", property.layerName);
         }
     }
 
@@ -275,22 +378,24 @@ class App {
     void printPhysicalDeviceInfo(VkPhysicalDevice& device) {
         VkPhysicalDeviceProperties property;
         vkGetPhysicalDeviceProperties(physical_device_, &property);
-        cout << "physic device property:" << endl;
-        cout << "\tname: " << property.deviceName << endl;
-        cout << "\tintergrated?: " << (property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU?"YES":"NO") << endl;
-        printf("\tapi version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.apiVersion),
-                VK_VERSION_MINOR(property.apiVersion),
-                VK_VERSION_PATCH(property.apiVersion)
-                );
-        printf("\tdriver version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.driverVersion),
-                VK_VERSION_MINOR(property.driverVersion),
-                VK_VERSION_PATCH(property.driverVersion)
-                );
+        Log("physic device property:");
+        Log("\tname: %s", property.deviceName);
+        Log("\tintergrated?: %s", property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ? "YES" : "NO");
+        Log("\tapi version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.apiVersion),
+            VK_VERSION_MINOR(property.apiVersion),
+            VK_VERSION_PATCH(property.apiVersion));
+        Log("\tdriver version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.driverVersion),
+            VK_VERSION_MINOR(property.driverVersion),
+            VK_VERSION_PATCH(property.driverVersion));
     }
 
     void createSurface() {
+        if (headless_) {
+            surface_ = VK_NULL_HANDLE;
+            return;
+        }
         bool result = SDL_Vulkan_CreateSurface(window_, instance_, &surface_);
         assertm("create surface failed", result == true);
     }
@@ -302,13 +407,16 @@ class App {
         create_info.ppEnabledLayerNames = nullptr;
 
         vector<const char*> extensions;
-        extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        if (!headless_) {
+            extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        }
         // On MacOS, the validation layer rely on this device extension, so we must add it.
-        if (EnableValidation) {
+        // other platforms(like lavapipe on Linux) don't have it
+        if (EnableValidation && checkDeviceExtensionSupport("VK_KHR_portability_subset")) {
             extensions.push_back("VK_KHR_portability_subset");
-            create_info.enabledExtensionCount = extensions.size();
-            create_info.ppEnabledExtensionNames = extensions.data();
         }
+        create_info.enabledExtensionCount = extensions.size();
+        create_info.ppEnabledExtensionNames = extensions.data();
 
         auto family_idx = getQueueFamilyIdx();
         assertm("can't find appropriate queue familise", family_idx.Valid());
@@ -331,6 +439,19 @@ class App {
         vkGetDeviceQueue(device_, family_idx.present_queue_idx.value(), 0, &present_queue_);
     }
 
+    bool checkDeviceExtensionSupport(const char* name) {
+        uint32_t count;
+        vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &count, nullptr);
+        vector<VkExtensionProperties> properties(count);
+        vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &count, properties.data());
+        for (auto& property: properties) {
+            if (strcmp(name, property.extensionName) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     QueueFamilyIdx getQueueFamilyIdx() {
         uint32_t count;
         vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &count, nullptr);
@@ -341,8 +462,11 @@ class App {
         for (int i = 0; i < properties.size(); i++) {
             if (properties.at(i).queueFlags&VK_QUEUE_GRAPHICS_BIT) {
                 family_idx.graphic_queue_idx = i;
-                VkBool32 is_present = false;
-                vkGetPhysicalDeviceSurfaceSupportKHR(physical_device_, i, surface_, &is_present);
+                // nothing is presented in headless mode, any graphic queue is ok
+                VkBool32 is_present = headless_;
+                if (!headless_) {
+                    vkGetPhysicalDeviceSurfaceSupportKHR(physical_device_, i, surface_, &is_present);
+                }
                 if (is_present) {
                     family_idx.present_queue_idx = i;
                     break;
@@ -370,10 +494,10 @@ class App {
         create_info.imageFormat = format.format;
 
         if (format.format == VK_FORMAT_B8G8R8A8_SRGB) {
-            cout << "surface format: BGRA8888 SRGB" << endl;
+            Log("surface format: BGRA8888 SRGB");
         }
         if (format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-            cout << "surface color space: SRGB" << endl;
+            Log("surface color space: SRGB");
         }
 
         auto capabilities = getSurfaceCapabilities();
@@ -381,18 +505,20 @@ class App {
         if (image_count < capabilities.minImageCount || image_count > capabilities.maxImageCount) {
             image_count = capabilities.minImageCount;
         }
-        cout << "image_count = " << image_count << endl;
+        Log("image_count = %u", image_count);
         create_info.minImageCount = image_count;
 
-        VkExtent2D extent = {WindowWidth, WindowHeight};
-        if (extent.width <= capabilities.minImageExtent.width || extent.width >= capabilities.maxImageExtent.width) {
-            extent.width = capabilities.maxImageExtent.width;
-        }
-        if (extent.height <= capabilities.minImageExtent.height || extent.height >= capabilities.maxImageExtent.height) {
-            extent.height = capabilities.maxImageExtent.height;
+        // currentExtent is the window size, if it is 0xFFFFFFFF the surface size is decided by swapchain
+        VkExtent2D extent = capabilities.currentExtent;
+        if (extent.width == std::numeric_limits<uint32_t>::max()) {
+            int w, h;
+            SDL_Vulkan_GetDrawableSize(window_, &w, &h);
+            extent.width = std::clamp(static_cast<uint32_t>(w), capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+            extent.height = std::clamp(static_cast<uint32_t>(h), capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
         }
         create_info.imageExtent = extent;
-        printf("extent = (%d, %d)\n", extent.width, extent.height);
+        swapchain_extent_ = extent;
+        Log("extent = (%u, %u)", extent.width, extent.height);
 
         auto family_idx = getQueueFamilyIdx();
         uint32_t idices[] = {family_idx.graphic_queue_idx.value(), family_idx.present_queue_idx.value()};
@@ -412,7 +538,8 @@ class App {
         create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         create_info.clipped = VK_TRUE;
         create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-        create_info.oldSwapchain = nullptr;
+        // when recreating, the old swapchain let driver reuse its resources and finish presenting old images
+        create_info.oldSwapchain = swapchain_;
         create_info.pNext = nullptr;
 
         assertm("can't create swapchain", vkCreateSwapchainKHR(device_, &create_info, nullptr, &swapchain_) == VK_SUCCESS);
@@ -422,7 +549,47 @@ class App {
         images_.resize(count);
         vkGetSwapchainImagesKHR(device_, swapchain_, &count, images_.data());
 
-        printf("got %d images\n", count);
+        Log("got %u images", count);
+    }
+
+    // render into one offscreen image instead of swapchain images
+    void createOffscreenTarget() {
+        offscreen_.Init(physical_device_, device_, VK_FORMAT_B8G8R8A8_SRGB, {WindowWidth, WindowHeight});
+        images_ = {offscreen_.Image()};
+        swapchain_extent_ = offscreen_.Extent();
+        Log("offscreen extent = (%u, %u)", swapchain_extent_.width, swapchain_extent_.height);
+    }
+
+    // let the present mode decide how to pace frames, see frame_pacer.hpp
+    void setupFramePacer() {
+        // nothing to show, run as fast as possible to measure throughput
+        if (headless_) {
+            pacer_.SetMode(PaceMode::Uncapped);
+            return;
+        }
+
+        double refresh_rate = 60;
+        SDL_DisplayMode mode;
+        if (SDL_GetWindowDisplayMode(window_, &mode) == 0 && mode.refresh_rate > 0) {
+            refresh_rate = mode.refresh_rate;
+        }
+
+        switch (getSurfacePresent()) {
+            case VK_PRESENT_MODE_MAILBOX_KHR:
+                pacer_.SetPresentMode(PresentPacing::Mailbox, refresh_rate);
+                break;
+            case VK_PRESENT_MODE_IMMEDIATE_KHR:
+                pacer_.SetPresentMode(PresentPacing::Immediate, refresh_rate);
+                break;
+            default:
+                pacer_.SetPresentMode(PresentPacing::Fifo, refresh_rate);
+                break;
+        }
+    }
+
+    // format of the images we render into
+    VkFormat getColorFormat() {
+        return headless_ ? offscreen_.Format() : getSurfaceFormat().format;
     }
 
     VkSurfaceFormatKHR getSurfaceFormat() {
@@ -464,7 +631,7 @@ class App {
             VkImageViewCreateInfo create_info = {};
             create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
             create_info.image = images_.at(i);
-            create_info.format = getSurfaceFormat().format;
+            create_info.format = getColorFormat();
             create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
             create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
             create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -480,11 +647,16 @@ class App {
     }
 
     VkShaderModule createShaderModule(string filename) {
+        string content = ReadShader(filename);
+        return createShaderModule((const uint32_t*)(content.data()), content.size());
+    }
+
+    // size is in bytes
+    VkShaderModule createShaderModule(const uint32_t* code, size_t size) {
         VkShaderModuleCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        string content = ReadShader(filename);
-        create_info.codeSize = content.size();
-        create_info.pCode = (const uint32_t*)(content.data());
+        create_info.codeSize = size;
+        create_info.pCode = code;
 
         VkShaderModule shader;
         assertm("can't create shader", vkCreateShaderModule(device_, &create_info, nullptr, &shader) == VK_SUCCESS);
@@ -511,34 +683,25 @@ class App {
 
         create_info.pInputAssemblyState = &assembly_create_info;
 
-        // viewport and scissors
-        VkViewport viewport;
-        viewport.x = 0;
-        viewport.y = 0;
-        int w, h;
-        SDL_Vulkan_GetDrawableSize(window_, &w, &h);
-        viewport.width = w;
-        viewport.height = h;
-        viewport.maxDepth = 1;
-        viewport.minDepth = 0;
-
-        VkRect2D rect;
-        rect.offset = {0, 0};
-        rect.extent.width = w;
-        rect.extent.height = h;
-
+        // viewport and scissors are dynamic states, set them when recording command buffers,
+        // so resizing window don't need a new pipeline
         VkPipelineViewportStateCreateInfo viewport_create_info = {};
         viewport_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewport_create_info.scissorCount = 1;
-        viewport_create_info.pScissors = &rect;
-        viewport_create_info.pViewports = &viewport;
+        viewport_create_info.pScissors = nullptr;
+        viewport_create_info.pViewports = nullptr;
         viewport_create_info.viewportCount = 1;
 
         create_info.pViewportState = &viewport_create_info;
 
         // shaders
+#ifdef EMBEDDED_SHADERS
+        VkShaderModule vert_module = createShaderModule(EmbeddedVertSpv, sizeof(EmbeddedVertSpv)),
+                       frag_module = createShaderModule(EmbeddedFragSpv, sizeof(EmbeddedFragSpv));
+#else
         VkShaderModule vert_module = createShaderModule("shader/vert.spv"),
                        frag_module = createShaderModule("shader/frag.spv");
+#endif
 
         VkPipelineShaderStageCreateInfo vert_create_info = {};
         vert_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -614,7 +777,13 @@ class App {
         create_info.renderPass = renderpass_;
 
         // dynamic state
-        create_info.pDynamicState = nullptr;
+        VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamic_create_info = {};
+        dynamic_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamic_create_info.dynamicStateCount = 2;
+        dynamic_create_info.pDynamicStates = dynamic_states;
+
+        create_info.pDynamicState = &dynamic_create_info;
 
         // create pipeline
         assertm("pipeline can't create", vkCreateGraphicsPipelines(device_, nullptr, 1, &create_info, nullptr, &pipeline_) == VK_SUCCESS);
@@ -630,14 +799,15 @@ class App {
         
         // attachment description
         VkAttachmentDescription description = {};
-        description.format = getSurfaceFormat().format;
+        description.format = getColorFormat();
         description.samples = VK_SAMPLE_COUNT_1_BIT;
         description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
         description.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        description.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        // offscreen image is copied to readback buffer after the render pass
+        description.finalLayout = headless_ ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
         // subpass
         VkAttachmentReference reference = {};
@@ -674,14 +844,12 @@ class App {
     }
 
     void createFramebuffer() {
-        int w, h;
-        SDL_Vulkan_GetDrawableSize(window_, &w, &h);
         framebuffers_.resize(images_.size());
         for (int i = 0; i < images_.size(); i++) {
             VkFramebufferCreateInfo create_info = {};
             create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            create_info.width = w;
-            create_info.height = h;
+            create_info.width = swapchain_extent_.width;
+            create_info.height = swapchain_extent_.height;
             create_info.attachmentCount = 1;
             create_info.pAttachments = &imageviews_.at(i);
             create_info.renderPass = renderpass_;
@@ -719,41 +887,140 @@ class App {
             renderpass_begin_info.pClearValues = &clear_value;
             renderpass_begin_info.framebuffer = framebuffers_.at(i);
             renderpass_begin_info.renderArea.offset = {0, 0};
-            int w, h;
-            SDL_Vulkan_GetDrawableSize(window_, &w, &h);
-            renderpass_begin_info.renderArea.extent.width = w;
-            renderpass_begin_info.renderArea.extent.height = h;
+            renderpass_begin_info.renderArea.extent = swapchain_extent_;
 
             vkCmdBeginRenderPass(buffer, &renderpass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
 
             vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
+
+            VkViewport viewport = {};
+            viewport.x = 0;
+            viewport.y = 0;
+            viewport.width = swapchain_extent_.width;
+            viewport.height = swapchain_extent_.height;
+            viewport.minDepth = 0;
+            viewport.maxDepth = 1;
+            vkCmdSetViewport(buffer, 0, 1, &viewport);
+
+            VkRect2D scissor = {};
+            scissor.offset = {0, 0};
+            scissor.extent = swapchain_extent_;
+            vkCmdSetScissor(buffer, 0, 1, &scissor);
+
             vkCmdDraw(buffer, 3, 1, 0, 0);
 
             vkCmdEndRenderPass(buffer);
 
+            if (headless_) {
+                offscreen_.RecordReadback(buffer);
+            }
+
             assertm("can't end record command buffer", vkEndCommandBuffer(buffer) == VK_SUCCESS);
         }
     }
 
-    void createSemaphores() {
+    void createSyncObjects() {
+        image_avaliable_semaphores_.resize(MaxFramesInFlight);
+        present_finish_semaphores_.resize(MaxFramesInFlight);
+        inflight_fences_.resize(MaxFramesInFlight);
+        images_inflight_.resize(images_.size(), VK_NULL_HANDLE);
+
         VkSemaphoreCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        assertm("create image avaliable semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &image_avaliable_semaphore_) == VK_SUCCESS);
-        assertm("create present finish semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &present_finish_semaphore_) == VK_SUCCESS);
+
+        // create fences signaled, so the first wait of each frame won't block forever
+        VkFenceCreateInfo fence_create_info = {};
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            assertm("create image avaliable semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &image_avaliable_semaphores_.at(i)) == VK_SUCCESS);
+            assertm("create present finish semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &present_finish_semaphores_.at(i)) == VK_SUCCESS);
+            assertm("create inflight fence failed", vkCreateFence(device_, &fence_create_info, nullptr, &inflight_fences_.at(i)) == VK_SUCCESS);
+        }
+    }
+
+    // when window resized, things depending on swapchain images are rebuilt.
+    // command buffers are recorded once with the extent, so they are recorded again too.
+    // pipeline uses dynamic viewport/scissor and render pass only depends on surface format, so we keep them
+    void recreateSwapchain() {
+        // minimized window has 0 size, wait untill it shows again
+        int w = 0, h = 0;
+        SDL_Vulkan_GetDrawableSize(window_, &w, &h);
+        while ((w == 0 || h == 0) && !ShouldClose()) {
+            SDL_WaitEvent(&event);
+            if (event.type == SDL_QUIT) {
+                Exit();
+            }
+            SDL_Vulkan_GetDrawableSize(window_, &w, &h);
+        }
+        if (ShouldClose()) {
+            return;
+        }
+
+        vkDeviceWaitIdle(device_);
+
+        vkFreeCommandBuffers(device_, commandpool_, command_buffers_.size(), command_buffers_.data());
+        for (auto& framebuffer: framebuffers_) {
+            vkDestroyFramebuffer(device_, framebuffer, nullptr);
+        }
+        for (auto& view: imageviews_) {
+            vkDestroyImageView(device_, view, nullptr);
+        }
+
+        VkSwapchainKHR old_swapchain = swapchain_;
+        createSwapchain();
+        vkDestroySwapchainKHR(device_, old_swapchain, nullptr);
+
+        createImageViews();
+        createFramebuffer();
+        createCommandBuffer();
+        prepDraw();
+
+        // image count may change, and no image is used by GPU now
+        images_inflight_.assign(images_.size(), VK_NULL_HANDLE);
+        framebuffer_resized_ = false;
+        Log("swapchain recreated, extent = (%u, %u)", swapchain_extent_.width, swapchain_extent_.height);
     }
 
     void drawFrame() {
-        uint32_t image_idx;
-        vkAcquireNextImageKHR(device_, swapchain_, std::numeric_limits<uint64_t>::max(), image_avaliable_semaphore_, nullptr, &image_idx);
+        using Clock = std::chrono::steady_clock;
+
+        // wait untill GPU finished the frame which used these sync objects last time
+        auto wait_begin = Clock::now();
+        vkWaitForFences(device_, 1, &inflight_fences_.at(current_frame_), VK_TRUE, std::numeric_limits<uint64_t>::max());
+        double wait_ms = std::chrono::duration<double, std::milli>(Clock::now() - wait_begin).count();
+
+        // headless mode always draws on the only offscreen image
+        uint32_t image_idx = 0;
+        if (!headless_) {
+            VkResult result = vkAcquireNextImageKHR(device_, swapchain_, std::numeric_limits<uint64_t>::max(), image_avaliable_semaphores_.at(current_frame_), nullptr, &image_idx);
+            // swapchain don't match the window any more, we can't draw on it.
+            // the fence is not reset yet, so returning here is safe
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapchain();
+                return;
+            }
+            assertm("can't acquire swapchain image", result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+        }
+
+        // swapchain may give us an image which an older frame is still drawing on
+        if (images_inflight_.at(image_idx) != VK_NULL_HANDLE) {
+            wait_begin = Clock::now();
+            vkWaitForFences(device_, 1, &images_inflight_.at(image_idx), VK_TRUE, std::numeric_limits<uint64_t>::max());
+            wait_ms += std::chrono::duration<double, std::milli>(Clock::now() - wait_begin).count();
+        }
+        images_inflight_.at(image_idx) = inflight_fences_.at(current_frame_);
 
         VkSubmitInfo submit_info = {};
         submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore wait_semaphores[] = {image_avaliable_semaphore_};
+        VkSemaphore wait_semaphores[] = {image_avaliable_semaphores_.at(current_frame_)};
         VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
         // the submit will block untill wait_semaphores signalled;
-        submit_info.waitSemaphoreCount = 1;
+        // offscreen image is always avaliable, and nobody waits to present it
+        submit_info.waitSemaphoreCount = headless_ ? 0 : 1;
         submit_info.pWaitSemaphores = wait_semaphores;
 
         // the stage(situation) you want to wait the semaphore
@@ -763,27 +1030,43 @@ class App {
         submit_info.commandBufferCount = 1;
         submit_info.pCommandBuffers = &command_buffers_.at(image_idx);
 
-        VkSemaphore signal_semaphores[] = {present_finish_semaphore_};
-        // the sumbit will signal the present_finish_semaphore_ when finish
-        submit_info.signalSemaphoreCount = 1;
+        VkSemaphore signal_semaphores[] = {present_finish_semaphores_.at(current_frame_)};
+        // the sumbit will signal the present finish semaphore when finish
+        submit_info.signalSemaphoreCount = headless_ ? 0 : 1;
         submit_info.pSignalSemaphores = signal_semaphores;
 
-        assertm("can't submit command", vkQueueSubmit(graphic_queue_, 1, &submit_info, nullptr) == VK_SUCCESS);
-
-        VkPresentInfoKHR present_info = {};
-        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        present_info.pImageIndices = &image_idx;
-        present_info.swapchainCount = 1;
-        present_info.pSwapchains = &swapchain_;
-        present_info.waitSemaphoreCount = 1;
-        present_info.pWaitSemaphores = signal_semaphores;
+        // the fence will be signaled when GPU finish this submit
+        vkResetFences(device_, 1, &inflight_fences_.at(current_frame_));
+        assertm("can't submit command", vkQueueSubmit(graphic_queue_, 1, &submit_info, inflight_fences_.at(current_frame_)) == VK_SUCCESS);
+
+        // nothing to present in headless mode, the readback is already in command buffer
+        if (!headless_) {
+            VkPresentInfoKHR present_info = {};
+            present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            present_info.pImageIndices = &image_idx;
+            present_info.swapchainCount = 1;
+            present_info.pSwapchains = &swapchain_;
+            present_info.waitSemaphoreCount = 1;
+            present_info.pWaitSemaphores = signal_semaphores;
+
+            VkResult result = vkQueuePresentKHR(present_queue_, &present_info);
+            if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebuffer_resized_) {
+                recreateSwapchain();
+            } else {
+                assertm("queue present failed", result == VK_SUCCESS);
+            }
+        }
 
-        assertm("queue present failed", vkQueuePresentKHR(present_queue_, &present_info) == VK_SUCCESS);
+        current_frame_ = (current_frame_ + 1) % MaxFramesInFlight;
+        overlap_stats_.AddFrame(wait_ms);
     }
 
     void quitVulkan() {
-        vkDestroySemaphore(device_, image_avaliable_semaphore_, nullptr);
-        vkDestroySemaphore(device_, present_finish_semaphore_, nullptr);
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            vkDestroySemaphore(device_, image_avaliable_semaphores_.at(i), nullptr);
+            vkDestroySemaphore(device_, present_finish_semaphores_.at(i), nullptr);
+            vkDestroyFence(device_, inflight_fences_.at(i), nullptr);
+        }
         vkFreeCommandBuffers(device_, commandpool_, command_buffers_.size(), command_buffers_.data());
         for (auto& framebuffer: framebuffers_) {
             vkDestroyFramebuffer(device_, framebuffer, nullptr);
@@ -794,17 +1077,35 @@ class App {
         for (auto& view: imageviews_) {
             vkDestroyImageView(device_, view, nullptr);
         }
-        vkDestroySwapchainKHR(device_, swapchain_, nullptr);
+        if (headless_) {
+            offscreen_.Destroy();
+        } else {
+            vkDestroySwapchainKHR(device_, swapchain_, nullptr);
+        }
         vkDestroyCommandPool(device_, commandpool_, nullptr);
         vkDestroyDevice(device_, nullptr);
-        vkDestroySurfaceKHR(instance_, surface_, nullptr);
+        if (!headless_) {
+            vkDestroySurfaceKHR(instance_, surface_, nullptr);
+        }
         vkDestroyInstance(instance_, nullptr);
     }
 };
 
 int main(int argc, char** argv) {
-    App app;
+    // --headless N: render N frames into an offscreen image without window, save the last one to headless.ppm, then quit.
+    // exit code is 1 if nothing was drawn
+    uint32_t headless_frames = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (string(argv[i]) == "--headless") {
+            headless_frames = std::atoi(argv[i + 1]);
+        }
+    }
+
+    App app(headless_frames > 0);
     app.SetTitle("15 draw triangle");
+    if (headless_frames > 0) {
+        return app.RunHeadless(headless_frames, "headless.ppm") ? 0 : 1;
+    }
     app.Run();
     return 0;
 }
@@ -0,0 +1,149 @@
+#ifndef INIT_GRAPH_HPP
+#define INIT_GRAPH_HPP
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "job_system.hpp"
+#include "log.hpp"
+
+/*
+ * InitGraph runs startup steps as a dependency graph instead of one after another.
+ *
+ * Add() a step with the steps it depends on, then Run() it on a JobSystem: every step whose
+ * dependencies finished is submitted at once, so independent steps(loading shader files,
+ * creating the pipeline, uploading buffers) run on different workers at the same time.
+ * When a step finishes, it submits its dependents whose last dependency it was.
+ *
+ * Steps running at the same time must not touch the same objects, put them in one step
+ * or make one depend on the other if they do.
+ *
+ * Report() prints when each step began, how long it took, and the critical path,
+ * which is what limits the startup time.
+ */
+class InitGraph {
+ public:
+    using Clock = std::chrono::steady_clock;
+    using StepId = uint32_t;
+    using Step = std::function<void()>;
+
+    // dependencies must be added before, so the graph can't have cycles
+    StepId Add(const std::string& name, const std::vector<StepId>& dependencies, Step step) {
+        StepId id = static_cast<StepId>(nodes_.size());
+        auto node = std::make_unique<Node>();
+        node->name = name;
+        node->step = std::move(step);
+        node->dependencies = dependencies;
+        node->pending.store(static_cast<uint32_t>(dependencies.size()), std::memory_order_relaxed);
+        for (StepId dependency: dependencies) {
+            assertm("init step depends on a step added after it", dependency < id);
+            nodes_.at(dependency)->dependents.push_back(id);
+        }
+        nodes_.push_back(std::move(node));
+        return id;
+    }
+
+    // block untill all steps finished
+    void Run(JobSystem& jobs) {
+        begin_ = Clock::now();
+        for (StepId id = 0; id < nodes_.size(); id++) {
+            if (nodes_.at(id)->dependencies.empty()) {
+                submit(jobs, id);
+            }
+        }
+        // a finishing step submits its dependents before it is counted as done, so Wait() sees them
+        jobs.Wait();
+        end_ = Clock::now();
+        assertm("some init steps never ran", finished_.load() == nodes_.size());
+    }
+
+    void Report() const {
+        double wall_ms = toMs(end_);
+        double total_ms = 0;
+        std::vector<StepId> order(nodes_.size());
+        for (StepId id = 0; id < nodes_.size(); id++) {
+            order.at(id) = id;
+            total_ms += toMs(nodes_.at(id)->end) - toMs(nodes_.at(id)->begin);
+        }
+        std::sort(order.begin(), order.end(), [this](StepId a, StepId b) {
+            return nodes_.at(a)->begin < nodes_.at(b)->begin;
+        });
+
+        Log("startup: %zu steps in %.3fms, %.3fms of work, %.2fx parallel", nodes_.size(), wall_ms, total_ms, total_ms / wall_ms);
+        for (StepId id: order) {
+            const Node& node = *nodes_.at(id);
+            Log("\t%-20s begin %8.3fms  took %8.3fms  worker %u",
+                node.name.c_str(), toMs(node.begin), toMs(node.end) - toMs(node.begin), node.worker);
+        }
+
+        // walk back from the last finished step, always through the dependency finished last
+        if (nodes_.empty()) {
+            return;
+        }
+        StepId id = order.front();
+        for (StepId other = 0; other < nodes_.size(); other++) {
+            if (nodes_.at(other)->end > nodes_.at(id)->end) {
+                id = other;
+            }
+        }
+        std::string path = nodes_.at(id)->name;
+        while (!nodes_.at(id)->dependencies.empty()) {
+            StepId last = nodes_.at(id)->dependencies.front();
+            for (StepId dependency: nodes_.at(id)->dependencies) {
+                if (nodes_.at(dependency)->end > nodes_.at(last)->end) {
+                    last = dependency;
+                }
+            }
+            id = last;
+            path = nodes_.at(id)->name + " -> " + path;
+        }
+        Log("startup critical path: %s", path.c_str());
+    }
+
+ private:
+    struct Node {
+        std::string name;
+        Step step;
+        std::vector<StepId> dependencies;
+        std::vector<StepId> dependents;
+        std::atomic<uint32_t> pending{0};
+        Clock::time_point begin;
+        Clock::time_point end;
+        uint32_t worker = 0;
+    };
+
+    // unique_ptr because atomics can't be moved when the vector grows
+    std::vector<std::unique_ptr<Node>> nodes_;
+    std::atomic<size_t> finished_{0};
+    Clock::time_point begin_;
+    Clock::time_point end_;
+
+    void submit(JobSystem& jobs, StepId id) {
+        jobs.Submit([this, &jobs, id](uint32_t worker) {
+            Node& node = *nodes_.at(id);
+            node.worker = worker;
+            node.begin = Clock::now();
+            node.step();
+            node.end = Clock::now();
+            LogDebug("init step %s finished in %.3fms", node.name.c_str(), toMs(node.end) - toMs(node.begin));
+            finished_.fetch_add(1);
+
+            for (StepId dependent: node.dependents) {
+                // acq_rel so the dependent sees everything its dependencies wrote
+                if (nodes_.at(dependent)->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    submit(jobs, dependent);
+                }
+            }
+        });
+    }
+
+    double toMs(Clock::time_point time) const {
+        return std::chrono::duration<double, std::milli>(time - begin_).count();
+    }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log.hpp"
+
+/*
+ * JobSystem owns a fixed number of worker threads which take jobs from one shared queue.
+ *
+ * Every job gets the index of the worker running it, so it can use resources owned by that worker
+ * (for example a VkCommandPool, which must not be used by two threads at the same time).
+ *
+ * Submit() jobs then Wait() for all of them, or use ParallelFor() to split a range of work.
+ */
+class JobSystem {
+ public:
+    using Job = std::function<void(uint32_t worker)>;
+
+    void Init(uint32_t thread_count) {
+        assertm("job system needs at least one thread", thread_count > 0);
+        quit_ = false;
+        for (uint32_t i = 0; i < thread_count; i++) {
+            threads_.emplace_back(&JobSystem::workerLoop, this, i);
+        }
+    }
+
+    uint32_t ThreadCount() const {
+        return static_cast<uint32_t>(threads_.size());
+    }
+
+    void Submit(Job job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(std::move(job));
+        }
+        job_cv_.notify_one();
+    }
+
+    // block untill all submitted jobs finished
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this]() { return jobs_.empty() && running_ == 0; });
+    }
+
+    // call func(i, worker) for every i in [0, count) on workers, return when all of them finished
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& func) {
+        for (uint32_t i = 0; i < count; i++) {
+            Submit([&func, i](uint32_t worker) { func(i, worker); });
+        }
+        Wait();
+    }
+
+    void Destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        job_cv_.notify_all();
+        for (auto& thread: threads_) {
+            thread.join();
+        }
+        threads_.clear();
+    }
+
+ private:
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable job_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Job> jobs_;
+    uint32_t running_ = 0;
+    bool quit_ = false;
+
+    void workerLoop(uint32_t worker) {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                job_cv_.wait(lock, [this]() { return quit_ || !jobs_.empty(); });
+                if (quit_ && jobs_.empty()) {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+                running_++;
+            }
+
+            job(worker);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                running_--;
+                if (jobs_.empty() && running_ == 0) {
+                    done_cv_.notify_all();
+                }
+            }
+        }
+    }
+};
+
+#endif
@@ -1,10 +1,234 @@
 #ifndef LOG_HPP
 #define LOG_HPP
-#include <cstdio>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/*
+ * Asynchronous logger.
+ *
+ * Log calls format the message into a slot of a lock-free bounded queue(many producers, one consumer),
+ * a background thread writes the slots to stdout. So logging never waits for the terminal,
+ * if the queue is full the message is dropped and counted instead of blocking.
+ *
+ * Every message carries level, file, line, function, thread and time since start.
+ *
+ * Levels lower than LOG_LEVEL are removed at compile time, they cost nothing
+ * (the call stays in a dead branch, so arguments are still checked by compiler).
+ * Change it by -DLOG_LEVEL=LOG_LEVEL_DEBUG.
+ *
+ * The queue is flushed at exit, and before assertm aborts, so the last messages are not lost.
+ */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+class Logger {
+ public:
+    static constexpr size_t Capacity = 4096;    // must be power of 2
+    static constexpr size_t MaxMessageSize = 256;
+
+    static Logger& Get() {
+        static Logger logger;
+        return logger;
+    }
+
+    ~Logger() {
+        running_.store(false, std::memory_order_release);
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+    }
+
+#if defined(__GNUC__)
+    __attribute__((format(printf, 6, 7)))
+#endif
+    void Write(int level, const char* file, int line, const char* function, const char* format, ...) {
+        uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[pos & (Capacity - 1)];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // writer is too far behind, never block the caller
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        Message& message = slot->message;
+        message.level = level;
+        message.file = file;
+        message.line = line;
+        message.function = function;
+        message.thread = threadIdx();
+        message.time = std::chrono::duration<double>(Clock::now() - start_).count();
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message.text, MaxMessageSize, format, args);
+        va_end(args);
+
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    // wait untill the writer thread wrote everything logged before
+    void Flush() {
+        uint64_t target = enqueue_pos_.load(std::memory_order_acquire);
+        while (written_.load(std::memory_order_acquire) < target && running_.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        fflush(stdout);
+    }
+
+ private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Message {
+        int level;
+        const char* file;
+        int line;
+        const char* function;
+        uint32_t thread;
+        double time;
+        char text[MaxMessageSize];
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        Message message;
+    };
+
+    std::vector<Slot> slots_;
+    std::atomic<uint64_t> enqueue_pos_{0};
+    uint64_t dequeue_pos_ = 0;     // only used by writer thread
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> running_{true};
+    std::atomic<uint32_t> thread_count_{0};
+    Clock::time_point start_ = Clock::now();
+    std::thread writer_;
 
-#define Log(format, ...) printf("[%s:%d]:" format "\n", __FUNCTION__, __LINE__, ##__VA_ARGS__)
-#define assertm(msg, condition) assert(((void)msg, condition))
+    Logger(): slots_(Capacity) {
+        for (size_t i = 0; i < Capacity; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        writer_ = std::thread(&Logger::writerLoop, this);
+    }
 
+    uint32_t threadIdx() {
+        thread_local uint32_t idx = thread_count_.fetch_add(1, std::memory_order_relaxed);
+        return idx;
+    }
+
+    static const char* levelName(int level) {
+        static const char* names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+        return level >= 0 && level < LOG_LEVEL_OFF ? names[level] : "?";
+    }
+
+    static const char* baseName(const char* path) {
+        const char* name = strrchr(path, '/');
+        return name ? name + 1 : path;
+    }
+
+    // write all finished messages, return false if there was nothing
+    bool drain() {
+        bool wrote = false;
+        while (true) {
+            Slot& slot = slots_[dequeue_pos_ & (Capacity - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+                break;
+            }
+            const Message& message = slot.message;
+            fprintf(stdout, "[%s %.3f t%u][%s:%d %s]: %s\n",
+                    levelName(message.level), message.time, message.thread,
+                    baseName(message.file), message.line, message.function, message.text);
+            slot.sequence.store(dequeue_pos_ + Capacity, std::memory_order_release);
+            dequeue_pos_++;
+            written_.store(dequeue_pos_, std::memory_order_release);
+            wrote = true;
+        }
+
+        uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            fprintf(stdout, "[WARN] logger queue is full, %llu messages dropped\n", static_cast<unsigned long long>(dropped));
+        }
+        if (wrote) {
+            fflush(stdout);
+        }
+        return wrote;
+    }
+
+    void writerLoop() {
+        while (running_.load(std::memory_order_acquire)) {
+            if (!drain()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        drain();
+    }
+};
+
+// flush the logger before a failed assert aborts, condition is evaluated only once
+inline bool LogCheck(bool ok) {
+    if (!ok) {
+        Logger::Get().Flush();
+    }
+    return ok;
+}
+
+#define LOG_AT(level, format, ...) Logger::Get().Write(level, __FILE__, __LINE__, __FUNCTION__, format, ##__VA_ARGS__)
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LogTrace(format, ...) LOG_AT(LOG_LEVEL_TRACE, format, ##__VA_ARGS__)
+#else
+#define LogTrace(format, ...) do { if (false) LOG_AT(LOG_LEVEL_TRACE, format, ##__VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LogDebug(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LogDebug(format, ...) do { if (false) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LogInfo(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LogInfo(format, ...) do { if (false) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LogWarn(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LogWarn(format, ...) do { if (false) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__); } while (0)
 #endif
 
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LogError(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LogError(format, ...) do { if (false) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__); } while (0)
+#endif
+
+#define Log(format, ...) LogInfo(format, ##__VA_ARGS__)
+#define assertm(msg, condition) assert(((void)msg, LogCheck(condition)))
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef MEMORY_ALLOCATOR_HPP
+#define MEMORY_ALLOCATOR_HPP
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * Vulkan limits how many VkDeviceMemory we can allocate(maxMemoryAllocationCount, usually 4096),
+ * and vkAllocateMemory is slow. So we allocate big blocks for each memory type,
+ * and give every buffer a piece of block.
+ *
+ * Each block has a free list sorted by offset. When allocating we choose the smallest free range
+ * which can hold the aligned size(best fit), when freeing we merge the range with its neighbours.
+ *
+ * A block is given back to driver when it becomes empty, except the last empty block of each memory type,
+ * it's kept for the next allocation and freed in Destroy().
+ *
+ * Host visible blocks are mapped once when created, because one VkDeviceMemory can't be mapped twice,
+ * use Allocation::mapped to write data.
+ */
+
+struct MemoryBlock;
+
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memory_type = 0;
+    void* mapped = nullptr;     // nullptr if memory is not host visible
+    MemoryBlock* block = nullptr;
+};
+
+struct MemoryBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memory_type = 0;
+    void* mapped = nullptr;
+    std::map<VkDeviceSize, VkDeviceSize> free_ranges;   // offset -> size
+    uint32_t allocation_count = 0;
+};
+
+class MemoryAllocator {
+ public:
+    static constexpr VkDeviceSize DefaultBlockSize = 32 * 1024 * 1024;
+
+    void Init(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size = DefaultBlockSize) {
+        device_ = device;
+        block_size_ = block_size;
+        vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties_);
+    }
+
+    // name is only used by leak report
+    Allocation Allocate(const VkMemoryRequirements& requirements, uint32_t memory_type, const char* name = "") {
+        Allocation allocation;
+        auto& blocks = blocks_.at(memory_type);
+        for (auto& block: blocks) {
+            if (allocFromBlock(*block, requirements, allocation)) {
+                break;
+            }
+        }
+
+        if (!allocation.block) {
+            // big resource get a block of its own
+            VkDeviceSize size = std::max(block_size_, requirements.size);
+            MemoryBlock* block = createBlock(memory_type, size);
+            if (!block && size > requirements.size) {
+                block = createBlock(memory_type, requirements.size);
+            }
+            assertm("can't allocate device memory block", block != nullptr);
+            bool ok = allocFromBlock(*block, requirements, allocation);
+            assertm("can't sub-allocate from new block", ok);
+        }
+
+        live_allocations_[{allocation.block, allocation.offset}] = LiveAllocation{allocation.size, name};
+        sub_allocation_count_++;
+        return allocation;
+    }
+
+    void Free(Allocation& allocation) {
+        if (!allocation.block) {
+            return;
+        }
+        MemoryBlock* block = allocation.block;
+        live_allocations_.erase({block, allocation.offset});
+        insertFreeRange(*block, allocation.offset, allocation.size);
+        block->allocation_count--;
+
+        // keep one empty block for each memory type, so create/destroy of a buffer every frame
+        // doesn't pay vkAllocateMemory/vkFreeMemory each time. give other empty blocks back to driver
+        if (block->allocation_count == 0 && (block->size > block_size_ || emptyBlockCount(block->memory_type) > 1)) {
+            destroyBlock(block);
+        }
+        allocation = Allocation{};
+    }
+
+    void PrintStats() const {
+        Log("memory allocator: %u vkAllocateMemory calls for %u sub-allocations",
+            device_allocation_count_, sub_allocation_count_);
+        for (uint32_t i = 0; i < mem_properties_.memoryTypeCount; i++) {
+            auto& blocks = blocks_.at(i);
+            if (blocks.empty()) {
+                continue;
+            }
+            VkDeviceSize total = 0, free = 0, largest_free = 0;
+            size_t free_range_count = 0;
+            for (auto& block: blocks) {
+                total += block->size;
+                for (auto& range: block->free_ranges) {
+                    free += range.second;
+                    largest_free = std::max(largest_free, range.second);
+                }
+                free_range_count += block->free_ranges.size();
+            }
+            // 0% means all free memory is in one piece, near 100% means free memory is broken into small pieces
+            double fragmentation = free == 0 ? 0.0 : 100.0 * (1.0 - double(largest_free) / double(free));
+            Log("\tmemory type %u: %zu blocks, %llu/%llu bytes used, %zu free ranges, fragmentation %.1f%%",
+                i, blocks.size(),
+                static_cast<unsigned long long>(total - free), static_cast<unsigned long long>(total),
+                free_range_count, fragmentation);
+        }
+    }
+
+    // report allocations which are not freed, then free all blocks
+    void Destroy() {
+        if (!live_allocations_.empty()) {
+            Log("memory allocator: %zu allocations leaked:", live_allocations_.size());
+            for (auto& [key, live]: live_allocations_) {
+                Log("\t%s: %llu bytes at offset %llu of memory type %u",
+                    live.name.empty() ? "<unnamed>" : live.name.c_str(),
+                    static_cast<unsigned long long>(live.size),
+                    static_cast<unsigned long long>(key.second),
+                    key.first->memory_type);
+            }
+        }
+        live_allocations_.clear();
+        for (auto& blocks: blocks_) {
+            for (auto& block: blocks) {
+                if (block->mapped) {
+                    vkUnmapMemory(device_, block->memory);
+                }
+                vkFreeMemory(device_, block->memory, nullptr);
+            }
+            blocks.clear();
+        }
+    }
+
+ private:
+    struct LiveAllocation {
+        VkDeviceSize size;
+        std::string name;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkDeviceSize block_size_ = DefaultBlockSize;
+    VkPhysicalDeviceMemoryProperties mem_properties_ = {};
+    std::array<std::vector<std::unique_ptr<MemoryBlock>>, VK_MAX_MEMORY_TYPES> blocks_;
+    std::map<std::pair<MemoryBlock*, VkDeviceSize>, LiveAllocation> live_allocations_;
+    uint32_t device_allocation_count_ = 0;
+    uint32_t sub_allocation_count_ = 0;
+
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    MemoryBlock* createBlock(uint32_t memory_type, VkDeviceSize size) {
+        VkMemoryAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocate_info.allocationSize = size;
+        allocate_info.memoryTypeIndex = memory_type;
+
+        auto block = std::make_unique<MemoryBlock>();
+        if (vkAllocateMemory(device_, &allocate_info, nullptr, &block->memory) != VK_SUCCESS) {
+            return nullptr;
+        }
+        device_allocation_count_++;
+        block->size = size;
+        block->memory_type = memory_type;
+        block->free_ranges[0] = size;
+        if (mem_properties_.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            assertm("can't map memory block", vkMapMemory(device_, block->memory, 0, size, 0, &block->mapped) == VK_SUCCESS);
+        }
+
+        blocks_.at(memory_type).push_back(std::move(block));
+        return blocks_.at(memory_type).back().get();
+    }
+
+    size_t emptyBlockCount(uint32_t memory_type) const {
+        auto& blocks = blocks_.at(memory_type);
+        return std::count_if(blocks.begin(), blocks.end(), [](const std::unique_ptr<MemoryBlock>& block) {
+            return block->allocation_count == 0;
+        });
+    }
+
+    void destroyBlock(MemoryBlock* block) {
+        auto& blocks = blocks_.at(block->memory_type);
+        for (auto it = blocks.begin(); it != blocks.end(); it++) {
+            if (it->get() == block) {
+                if (block->mapped) {
+                    vkUnmapMemory(device_, block->memory);
+                }
+                vkFreeMemory(device_, block->memory, nullptr);
+                blocks.erase(it);
+                return;
+            }
+        }
+    }
+
+    bool allocFromBlock(MemoryBlock& block, const VkMemoryRequirements& requirements, Allocation& allocation) {
+        VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+        // best fit: the free range which wastes least space
+        auto best = block.free_ranges.end();
+        VkDeviceSize best_waste = std::numeric_limits<VkDeviceSize>::max();
+        for (auto it = block.free_ranges.begin(); it != block.free_ranges.end(); it++) {
+            VkDeviceSize aligned = alignUp(it->first, alignment);
+            VkDeviceSize end = it->first + it->second;
+            if (aligned + requirements.size <= end) {
+                VkDeviceSize waste = it->second - requirements.size;
+                if (waste < best_waste) {
+                    best = it;
+                    best_waste = waste;
+                }
+            }
+        }
+        if (best == block.free_ranges.end()) {
+            return false;
+        }
+
+        VkDeviceSize range_offset = best->first, range_size = best->second;
+        VkDeviceSize aligned = alignUp(range_offset, alignment);
+        block.free_ranges.erase(best);
+        // the padding before aligned offset and the tail are still free
+        if (aligned > range_offset) {
+            block.free_ranges[range_offset] = aligned - range_offset;
+        }
+        VkDeviceSize tail = range_offset + range_size - (aligned + requirements.size);
+        if (tail > 0) {
+            block.free_ranges[aligned + requirements.size] = tail;
+        }
+
+        block.allocation_count++;
+        allocation.memory = block.memory;
+        allocation.offset = aligned;
+        allocation.size = requirements.size;
+        allocation.memory_type = block.memory_type;
+        allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + aligned : nullptr;
+        allocation.block = &block;
+        return true;
+    }
+
+    void insertFreeRange(MemoryBlock& block, VkDeviceSize offset, VkDeviceSize size) {
+        auto it = block.free_ranges.emplace(offset, size).first;
+
+        // merge with next range
+        auto next = std::next(it);
+        if (next != block.free_ranges.end() && it->first + it->second == next->first) {
+            it->second += next->second;
+            block.free_ranges.erase(next);
+        }
+
+        // merge with previous range
+        if (it != block.free_ranges.begin()) {
+            auto prev = std::prev(it);
+            if (prev->first + prev->second == it->first) {
+                prev->second += it->second;
+                block.free_ranges.erase(it);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef OFFSCREEN_TARGET_HPP
+#define OFFSCREEN_TARGET_HPP
+#include <array>
+#include <cstdio>
+#include <string>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * OffscreenTarget replaces the swapchain when there is no display(CI machines, software ICD like lavapipe).
+ *
+ * We render into a DEVICE_LOCAL VkImage, then copy it into a HOST_VISIBLE buffer at the end of each frame.
+ * The render pass must leave the image in TRANSFER_SRC_OPTIMAL layout, and the copy must be recorded
+ * after vkCmdEndRenderPass. When the frame's fence is signaled, Pixel()/SavePPM() read the result.
+ *
+ * Pixels are tightly packed, 4 bytes each, in the order of the image format(BGRA or RGBA).
+ */
+class OffscreenTarget {
+ public:
+    void Init(VkPhysicalDevice physical_device, VkDevice device, VkFormat format, VkExtent2D extent) {
+        device_ = device;
+        format_ = format;
+        extent_ = extent;
+        vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_properties_);
+
+        VkImageCreateInfo image_info = {};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = format;
+        image_info.extent = {extent.width, extent.height, 1};
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        assertm("can't create offscreen image", vkCreateImage(device_, &image_info, nullptr, &image_) == VK_SUCCESS);
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device_, image_, &requirements);
+        image_memory_ = allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        vkBindImageMemory(device_, image_, image_memory_, 0);
+
+        VkBufferCreateInfo buffer_info = {};
+        buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_info.size = Size();
+        buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        assertm("can't create readback buffer", vkCreateBuffer(device_, &buffer_info, nullptr, &readback_buffer_) == VK_SUCCESS);
+
+        vkGetBufferMemoryRequirements(device_, readback_buffer_, &requirements);
+        readback_memory_ = allocate(requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        vkBindBufferMemory(device_, readback_buffer_, readback_memory_, 0);
+        assertm("can't map readback buffer", vkMapMemory(device_, readback_memory_, 0, Size(), 0, &mapped_) == VK_SUCCESS);
+    }
+
+    VkImage Image() const {
+        return image_;
+    }
+
+    VkFormat Format() const {
+        return format_;
+    }
+
+    VkExtent2D Extent() const {
+        return extent_;
+    }
+
+    VkDeviceSize Size() const {
+        return static_cast<VkDeviceSize>(extent_.width) * extent_.height * 4;
+    }
+
+    // record it after the render pass, the image must be in TRANSFER_SRC_OPTIMAL layout
+    void RecordReadback(VkCommandBuffer buffer) {
+        // the implicit dependency at the end of render pass don't wait for anything,
+        // so wait color attachment writes before copying
+        VkImageMemoryBarrier image_barrier = {};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.image = image_;
+        image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        image_barrier.subresourceRange.baseMipLevel = 0;
+        image_barrier.subresourceRange.levelCount = 1;
+        image_barrier.subresourceRange.baseArrayLayer = 0;
+        image_barrier.subresourceRange.layerCount = 1;
+        vkCmdPipelineBarrier(buffer,
+                             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &image_barrier);
+
+        VkBufferImageCopy region = {};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0;     // 0 means tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {extent_.width, extent_.height, 1};
+        vkCmdCopyImageToBuffer(buffer, image_, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback_buffer_, 1, &region);
+
+        // make the copy visible to vkMapMemory pointer after the fence
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = readback_buffer_;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    // RGBA of the pixel, only valid after GPU finished the readback
+    std::array<uint8_t, 4> Pixel(uint32_t x, uint32_t y) const {
+        const uint8_t* p = static_cast<const uint8_t*>(mapped_) + (static_cast<VkDeviceSize>(y) * extent_.width + x) * 4;
+        if (isBGRA()) {
+            return {p[2], p[1], p[0], p[3]};
+        }
+        return {p[0], p[1], p[2], p[3]};
+    }
+
+    // binary PPM, any image viewer can open it
+    bool SavePPM(const std::string& path) const {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            Log("can't open %s", path.c_str());
+            return false;
+        }
+        fprintf(file, "P6\n%u %u\n255\n", extent_.width, extent_.height);
+        for (uint32_t y = 0; y < extent_.height; y++) {
+            for (uint32_t x = 0; x < extent_.width; x++) {
+                auto pixel = Pixel(x, y);
+                fwrite(pixel.data(), 1, 3, file);
+            }
+        }
+        fclose(file);
+        return true;
+    }
+
+    void Destroy() {
+        vkUnmapMemory(device_, readback_memory_);
+        vkDestroyBuffer(device_, readback_buffer_, nullptr);
+        vkFreeMemory(device_, readback_memory_, nullptr);
+        vkDestroyImage(device_, image_, nullptr);
+        vkFreeMemory(device_, image_memory_, nullptr);
+    }
+
+ private:
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties mem_properties_ = {};
+    VkFormat format_ = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent_ = {0, 0};
+    VkImage image_ = VK_NULL_HANDLE;
+    VkDeviceMemory image_memory_ = VK_NULL_HANDLE;
+    VkBuffer readback_buffer_ = VK_NULL_HANDLE;
+    VkDeviceMemory readback_memory_ = VK_NULL_HANDLE;
+    void* mapped_ = nullptr;
+
+    bool isBGRA() const {
+        return format_ == VK_FORMAT_B8G8R8A8_SRGB || format_ == VK_FORMAT_B8G8R8A8_UNORM;
+    }
+
+    VkDeviceMemory allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties) {
+        uint32_t memory_type = mem_properties_.memoryTypeCount;
+        for (uint32_t i = 0; i < mem_properties_.memoryTypeCount; i++) {
+            if ((requirements.memoryTypeBits & (1 << i)) &&
+                (mem_properties_.memoryTypes[i].propertyFlags & properties) == properties) {
+                memory_type = i;
+                break;
+            }
+        }
+        assertm("can't find memory type for offscreen target", memory_type != mem_properties_.memoryTypeCount);
+
+        VkMemoryAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocate_info.allocationSize = requirements.size;
+        allocate_info.memoryTypeIndex = memory_type;
+
+        VkDeviceMemory memory;
+        assertm("can't allocate offscreen memory", vkAllocateMemory(device_, &allocate_info, nullptr, &memory) == VK_SUCCESS);
+        return memory;
+    }
+};
+
+#endif
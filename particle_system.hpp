@@ -0,0 +1,326 @@
+#ifndef PARTICLE_SYSTEM_HPP
+#define PARTICLE_SYSTEM_HPP
+#include <array>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+#include "glm/glm.hpp"
+
+#include "frame_command_pool.hpp"
+#include "log.hpp"
+
+/*
+ * ParticleSystem simulates particles with a compute shader(shader/particle.comp),
+ * the graphic pipeline draws the same buffers as vertex buffers(pos and color are vertex attributes).
+ *
+ * Every frame in flight has a particle buffer. Step k reads buffer k % n and writes buffer (k + 1) % n,
+ * which is drawn by frame k. Step k + n writes the same buffer again, but the CPU waits the fence of frame k
+ * before that, so the simulation never overwrites what is still drawn.
+ *
+ * If the device has a compute queue family without graphic, steps are submitted there(async compute),
+ * so they run while the graphic queue is still drawing the last frame. The graphic submit waits
+ * Semaphore() at VERTEX_INPUT stage. Buffers are shared CONCURRENT by both families, so no ownership transfer.
+ * Otherwise RecordStep() puts the dispatch into the frame's command buffer, a buffer memory barrier
+ * lets the vertex input read what compute shader wrote.
+ */
+struct Particle {
+    glm::vec2 pos;
+    glm::vec2 vel;
+    glm::vec4 color;
+
+    static VkVertexInputBindingDescription GetBindingDescriptions() {
+        VkVertexInputBindingDescription description = {};
+        description.binding = 0;
+        description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        description.stride = sizeof(Particle);
+        return description;
+    }
+
+    // same locations as Vertex, so it works with the same fragment shader
+    static std::array<VkVertexInputAttributeDescription, 2> GetAttribDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> descriptions;
+
+        descriptions[0].binding = 0;
+        descriptions[0].location = 0;
+        descriptions[0].offset = offsetof(Particle, pos);
+        descriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+
+        descriptions[1].binding = 0;
+        descriptions[1].location = 1;
+        descriptions[1].offset = offsetof(Particle, color);
+        descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+
+        return descriptions;
+    }
+};
+
+class ParticleSystem {
+ public:
+    static constexpr uint32_t GroupSize = 256;    // local_size_x of particle.comp
+
+    // same layout as push constants of particle.comp
+    struct Params {
+        float dt;
+        uint32_t count;
+        uint32_t init;
+    };
+
+    // queue is on compute_family, if it is not graphic_family the simulation runs async
+    void Init(VkDevice device, VkShaderModule module, VkPipelineCache cache,
+              VkQueue queue, uint32_t compute_family, uint32_t graphic_family, uint32_t frame_count) {
+        device_ = device;
+        queue_ = queue;
+        queue_family_ = compute_family;
+        async_ = compute_family != graphic_family;
+
+        // 0: particles of last step, 1: particles of this step
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+        for (uint32_t i = 0; i < bindings.size(); i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        VkDescriptorSetLayoutCreateInfo layout_info = {};
+        layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layout_info.bindingCount = bindings.size();
+        layout_info.pBindings = bindings.data();
+        assertm("can't create particle descriptor set layout", vkCreateDescriptorSetLayout(device_, &layout_info, nullptr, &set_layout_) == VK_SUCCESS);
+
+        VkPushConstantRange push_range = {};
+        push_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        push_range.offset = 0;
+        push_range.size = sizeof(Params);
+
+        VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+        pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipeline_layout_info.setLayoutCount = 1;
+        pipeline_layout_info.pSetLayouts = &set_layout_;
+        pipeline_layout_info.pushConstantRangeCount = 1;
+        pipeline_layout_info.pPushConstantRanges = &push_range;
+        assertm("can't create particle pipeline layout", vkCreatePipelineLayout(device_, &pipeline_layout_info, nullptr, &pipeline_layout_) == VK_SUCCESS);
+
+        VkComputePipelineCreateInfo pipeline_info = {};
+        pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipeline_info.stage.module = module;
+        pipeline_info.stage.pName = "main";
+        pipeline_info.layout = pipeline_layout_;
+        assertm("can't create particle pipeline", vkCreateComputePipelines(device_, cache, 1, &pipeline_info, nullptr, &pipeline_) == VK_SUCCESS);
+
+        VkDescriptorPoolSize pool_size = {};
+        pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        pool_size.descriptorCount = bindings.size() * frame_count;
+        VkDescriptorPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.maxSets = frame_count;
+        pool_info.poolSizeCount = 1;
+        pool_info.pPoolSizes = &pool_size;
+        assertm("can't create particle descriptor pool", vkCreateDescriptorPool(device_, &pool_info, nullptr, &pool_) == VK_SUCCESS);
+
+        std::vector<VkDescriptorSetLayout> layouts(frame_count, set_layout_);
+        sets_.resize(frame_count);
+        VkDescriptorSetAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocate_info.descriptorPool = pool_;
+        allocate_info.descriptorSetCount = frame_count;
+        allocate_info.pSetLayouts = layouts.data();
+        assertm("can't allocate particle descriptor sets", vkAllocateDescriptorSets(device_, &allocate_info, sets_.data()) == VK_SUCCESS);
+
+        if (async_) {
+            command_pool_.Init(device_, compute_family, frame_count);
+            semaphores_.resize(frame_count);
+            VkSemaphoreCreateInfo semaphore_info = {};
+            semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            for (auto& semaphore: semaphores_) {
+                assertm("can't create particle semaphore", vkCreateSemaphore(device_, &semaphore_info, nullptr, &semaphore) == VK_SUCCESS);
+            }
+        }
+        Log("particle system: %s", async_ ? "async compute queue" : "graphic queue");
+    }
+
+    // buffers need STORAGE|VERTEX usage and count particles, one for each frame in flight.
+    // the next step creates new particles
+    void SetBuffers(const std::vector<VkBuffer>& buffers, uint32_t count) {
+        assertm("particle system needs one buffer for each frame", buffers.size() == sets_.size());
+        buffers_ = buffers;
+        count_ = count;
+        step_ = 0;
+        for (uint32_t i = 0; i < sets_.size(); i++) {
+            std::array<VkDescriptorBufferInfo, 2> infos = {};
+            infos[0] = {buffers_.at(i), 0, VK_WHOLE_SIZE};
+            infos[1] = {buffers_.at((i + 1) % buffers_.size()), 0, VK_WHOLE_SIZE};
+
+            std::array<VkWriteDescriptorSet, 2> writes = {};
+            for (uint32_t j = 0; j < writes.size(); j++) {
+                writes[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[j].dstSet = sets_.at(i);
+                writes[j].dstBinding = j;
+                writes[j].descriptorCount = 1;
+                writes[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[j].pBufferInfo = &infos[j];
+            }
+            vkUpdateDescriptorSets(device_, writes.size(), writes.data(), 0, nullptr);
+        }
+    }
+
+    bool Enabled() const {
+        return count_ > 0;
+    }
+
+    bool Async() const {
+        return async_;
+    }
+
+    uint32_t Count() const {
+        return count_;
+    }
+
+    // async only: record and submit the step of this frame, call it after the frame's fence was signaled.
+    // the graphic submit of this frame must wait Semaphore(frame_idx)
+    void SubmitStep(uint32_t frame_idx, float dt) {
+        command_pool_.Reset(frame_idx);
+        VkCommandBuffer buffer = command_pool_.Get(frame_idx);
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        assertm("can't begin particle command buffer", vkBeginCommandBuffer(buffer, &begin_info) == VK_SUCCESS);
+        recordDispatch(buffer, dt);
+        assertm("can't end particle command buffer", vkEndCommandBuffer(buffer) == VK_SUCCESS);
+
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &buffer;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &semaphores_.at(frame_idx);
+        assertm("can't submit particle step", vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE) == VK_SUCCESS);
+    }
+
+    VkSemaphore Semaphore(uint32_t frame_idx) const {
+        return semaphores_.at(frame_idx);
+    }
+
+    // not async only: record the step into the frame's command buffer, outside render pass
+    void RecordStep(VkCommandBuffer buffer, float dt) {
+        recordDispatch(buffer, dt);
+
+        // draws of this frame read the particles as vertex attributes
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = RenderBuffer();
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(buffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    // written by the last step
+    VkBuffer RenderBuffer() const {
+        return buffers_.at(step_ % buffers_.size());
+    }
+
+    // run steps back to back on the simulation queue and wait, print particles simulated per second.
+    // call it when the queue is idle
+    double Benchmark(uint32_t steps) {
+        using Clock = std::chrono::steady_clock;
+
+        FrameCommandPool pool;
+        pool.Init(device_, queue_family_, 1);
+        VkCommandBuffer buffer = pool.Get(0);
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        assertm("can't begin particle command buffer", vkBeginCommandBuffer(buffer, &begin_info) == VK_SUCCESS);
+        for (uint32_t i = 0; i < steps; i++) {
+            recordDispatch(buffer, 1.0f / 60.0f);
+        }
+        assertm("can't end particle command buffer", vkEndCommandBuffer(buffer) == VK_SUCCESS);
+
+        VkFenceCreateInfo fence_info = {};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        assertm("can't create particle fence", vkCreateFence(device_, &fence_info, nullptr, &fence) == VK_SUCCESS);
+
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &buffer;
+        auto begin = Clock::now();
+        assertm("can't submit particle benchmark", vkQueueSubmit(queue_, 1, &submit_info, fence) == VK_SUCCESS);
+        vkWaitForFences(device_, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        vkDestroyFence(device_, fence, nullptr);
+        pool.Destroy();
+
+        double per_second = double(count_) * steps / seconds;
+        Log("particles: %u particles, %u steps in %.3fms, %.3fms per step, %.1fM particles/s",
+            count_, steps, seconds * 1000.0, seconds * 1000.0 / steps, per_second / 1e6);
+        return per_second;
+    }
+
+    void Destroy() {
+        if (async_) {
+            for (auto& semaphore: semaphores_) {
+                vkDestroySemaphore(device_, semaphore, nullptr);
+            }
+            command_pool_.Destroy();
+        }
+        vkDestroyDescriptorPool(device_, pool_, nullptr);
+        vkDestroyPipeline(device_, pipeline_, nullptr);
+        vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
+        vkDestroyDescriptorSetLayout(device_, set_layout_, nullptr);
+    }
+
+ private:
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    uint32_t queue_family_ = 0;
+    bool async_ = false;
+    VkDescriptorSetLayout set_layout_ = VK_NULL_HANDLE;
+    VkPipelineLayout pipeline_layout_ = VK_NULL_HANDLE;
+    VkPipeline pipeline_ = VK_NULL_HANDLE;
+    VkDescriptorPool pool_ = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> sets_;     // set i reads buffer i and writes buffer i + 1
+    std::vector<VkBuffer> buffers_;
+    uint32_t count_ = 0;
+    uint64_t step_ = 0;
+    FrameCommandPool command_pool_;         // only for async
+    std::vector<VkSemaphore> semaphores_;   // only for async, signaled when the step of the frame finished
+
+    void recordDispatch(VkCommandBuffer buffer, float dt) {
+        // this step reads what the last step wrote, it may be in an earlier submit on the same queue
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = buffers_.at(step_ % buffers_.size());
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(buffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+        Params params = {dt, count_, step_ == 0 ? 1u : 0u};
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+        vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout_, 0, 1,
+                                &sets_.at(step_ % sets_.size()), 0, nullptr);
+        vkCmdPushConstants(buffer, pipeline_layout_, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Params), &params);
+        vkCmdDispatch(buffer, (count_ + GroupSize - 1) / GroupSize, 1, 1);
+        step_++;
+    }
+};
+
+#endif
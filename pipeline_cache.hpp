@@ -0,0 +1,136 @@
+#ifndef PIPELINE_CACHE_HPP
+#define PIPELINE_CACHE_HPP
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * PipelineCache keeps VkPipelineCache data in a file, so the driver don't compile shaders again on next launch.
+ *
+ * The file name contains vendorID, deviceID and pipelineCacheUUID, so different GPUs and drivers never share a file.
+ * Data is also checked against the header Vulkan writes in front of it(VK_PIPELINE_CACHE_HEADER_VERSION_ONE),
+ * and ignored if anything mismatch. Saving writes a temporary file then renames it,
+ * so a crash while saving never leaves a broken cache file.
+ */
+class PipelineCache {
+ public:
+    void Init(VkPhysicalDevice physical_device, VkDevice device, const std::string& dir = ".") {
+        device_ = device;
+        vkGetPhysicalDeviceProperties(physical_device, &properties_);
+        path_ = dir + "/" + fileName();
+
+        std::vector<char> data = readFile(path_);
+        loaded_ = !data.empty() && validate(data);
+        if (!data.empty() && !loaded_) {
+            Log("pipeline cache %s is invalid, ignore it", path_.c_str());
+        }
+
+        VkPipelineCacheCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        create_info.initialDataSize = loaded_ ? data.size() : 0;
+        create_info.pInitialData = loaded_ ? data.data() : nullptr;
+        assertm("can't create pipeline cache", vkCreatePipelineCache(device_, &create_info, nullptr, &cache_) == VK_SUCCESS);
+
+        Log("pipeline cache %s: %s", path_.c_str(), loaded_ ? "loaded(warm start)" : "empty(cold start)");
+    }
+
+    VkPipelineCache Get() const {
+        return cache_;
+    }
+
+    // true if cache data was loaded from file
+    bool Loaded() const {
+        return loaded_;
+    }
+
+    void Save() {
+        size_t size = 0;
+        vkGetPipelineCacheData(device_, cache_, &size, nullptr);
+        std::vector<char> data(size);
+        if (size == 0 || vkGetPipelineCacheData(device_, cache_, &size, data.data()) != VK_SUCCESS) {
+            return;
+        }
+
+        std::string tmp_path = path_ + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::binary|std::ios::trunc);
+            if (file.fail()) {
+                Log("can't write pipeline cache %s", tmp_path.c_str());
+                return;
+            }
+            file.write(data.data(), size);
+            if (file.fail()) {
+                Log("can't write pipeline cache %s", tmp_path.c_str());
+                std::remove(tmp_path.c_str());
+                return;
+            }
+        }
+        if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+            Log("can't replace pipeline cache %s", path_.c_str());
+            std::remove(tmp_path.c_str());
+            return;
+        }
+        Log("pipeline cache saved, %zu bytes", size);
+    }
+
+    void Destroy() {
+        Save();
+        vkDestroyPipelineCache(device_, cache_, nullptr);
+    }
+
+ private:
+    // layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+    struct CacheHeader {
+        uint32_t header_size;
+        uint32_t header_version;
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint8_t uuid[VK_UUID_SIZE];
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkPipelineCache cache_ = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties properties_ = {};
+    std::string path_;
+    bool loaded_ = false;
+
+    std::string fileName() const {
+        char name[128];
+        int len = snprintf(name, sizeof(name), "pipeline_cache_%04x_%04x_", properties_.vendorID, properties_.deviceID);
+        for (int i = 0; i < VK_UUID_SIZE; i++) {
+            len += snprintf(name + len, sizeof(name) - len, "%02x", properties_.pipelineCacheUUID[i]);
+        }
+        return std::string(name) + ".bin";
+    }
+
+    bool validate(const std::vector<char>& data) const {
+        if (data.size() < sizeof(CacheHeader)) {
+            return false;
+        }
+        CacheHeader header;
+        memcpy(&header, data.data(), sizeof(header));
+        return header.header_size >= sizeof(CacheHeader) &&
+               header.header_size <= data.size() &&
+               header.header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+               header.vendor_id == properties_.vendorID &&
+               header.device_id == properties_.deviceID &&
+               memcmp(header.uuid, properties_.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+
+    static std::vector<char> readFile(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (file.fail()) {
+            return {};
+        }
+        return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+};
+
+#endif
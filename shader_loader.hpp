@@ -0,0 +1,132 @@
+#ifndef SHADER_LOADER_HPP
+#define SHADER_LOADER_HPP
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * ShaderLoader creates VkShaderModules from SPIR-V files and keeps them untill Destroy().
+ *
+ * Files are mmap()ed instead of copied into a string, the mapping is page aligned,
+ * so the words can be given to vkCreateShaderModule directly. Before that the file is checked:
+ * size must be a whole number of 32 bit words, and it must start with the SPIR-V magic number.
+ *
+ * Modules are cached twice: by path, so a loaded file is never read again,
+ * and by a hash of the content, so two files with the same code share one module.
+ * Modules are owned by the loader, pipelines must not destroy them.
+ *
+ * LoadEmbedded() takes SPIR-V compiled into the binary(see shader/embedded_shaders.hpp rule in Makefile),
+ * it needs no file at all and is cached the same way, name is only used as the cache key.
+ *
+ * Load() and LoadEmbedded() can be called from several threads at the same time.
+ */
+class ShaderLoader {
+ public:
+    static constexpr uint32_t SpirvMagic = 0x07230203;
+    static constexpr size_t SpirvHeaderWords = 5;
+
+    void Init(VkDevice device) {
+        device_ = device;
+    }
+
+    VkShaderModule Load(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto by_path = path_cache_.find(path);
+        if (by_path != path_cache_.end()) {
+            return by_path->second;
+        }
+
+        int fd = open(path.c_str(), O_RDONLY);
+        assertm((path + " can't be open").c_str(), fd >= 0);
+        struct stat file_stat;
+        assertm((path + " can't be stat").c_str(), fstat(fd, &file_stat) == 0);
+        size_t size = static_cast<size_t>(file_stat.st_size);
+        assertm((path + " is not SPIR-V, size is not a multiple of 4").c_str(), size % sizeof(uint32_t) == 0);
+        assertm((path + " is not SPIR-V, too small").c_str(), size >= SpirvHeaderWords * sizeof(uint32_t));
+
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        assertm((path + " can't be mapped").c_str(), mapped != MAP_FAILED);
+
+        VkShaderModule module = createModule(path, static_cast<const uint32_t*>(mapped), size);
+        // driver copied the code, the mapping is not needed any more
+        munmap(mapped, size);
+        return module;
+    }
+
+    // code must be 4 byte aligned, size is in bytes
+    VkShaderModule LoadEmbedded(const std::string& name, const uint32_t* code, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto by_path = path_cache_.find(name);
+        if (by_path != path_cache_.end()) {
+            return by_path->second;
+        }
+        assertm((name + " is not SPIR-V, too small").c_str(), size >= SpirvHeaderWords * sizeof(uint32_t));
+        return createModule(name, code, size);
+    }
+
+    size_t ModuleCount() const {
+        return hash_cache_.size();
+    }
+
+    void Destroy() {
+        for (auto& [hash, module]: hash_cache_) {
+            vkDestroyShaderModule(device_, module, nullptr);
+        }
+        hash_cache_.clear();
+        path_cache_.clear();
+    }
+
+ private:
+    VkDevice device_ = VK_NULL_HANDLE;
+    std::mutex mutex_;
+    std::map<std::string, VkShaderModule> path_cache_;
+    std::map<uint64_t, VkShaderModule> hash_cache_;
+
+    // mutex_ must be locked
+    VkShaderModule createModule(const std::string& path, const uint32_t* code, size_t size) {
+        assertm((path + " is not SPIR-V, wrong magic number").c_str(), code[0] == SpirvMagic);
+
+        uint64_t hash = hashWords(code, size / sizeof(uint32_t));
+        VkShaderModule module;
+        auto by_hash = hash_cache_.find(hash);
+        bool shared = by_hash != hash_cache_.end();
+        if (shared) {
+            module = by_hash->second;
+        } else {
+            VkShaderModuleCreateInfo create_info = {};
+            create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            create_info.codeSize = size;
+            create_info.pCode = code;
+            assertm("can't create shader", vkCreateShaderModule(device_, &create_info, nullptr, &module) == VK_SUCCESS);
+            hash_cache_[hash] = module;
+        }
+
+        path_cache_[path] = module;
+        Log("shader %s: %zu bytes, %s", path.c_str(), size, shared ? "same as a loaded shader" : "new module");
+        return module;
+    }
+
+    // FNV-1a over the words, good enough to tell shaders apart
+    static uint64_t hashWords(const uint32_t* words, size_t count) {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < count; i++) {
+            hash ^= words[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+#endif
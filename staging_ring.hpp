@@ -0,0 +1,156 @@
+#ifndef STAGING_RING_HPP
+#define STAGING_RING_HPP
+#include <deque>
+#include <limits>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+
+/*
+ * StagingRing is one big HOST_VISIBLE|HOST_COHERENT buffer which is mapped forever.
+ * Uploads take pieces of it one after another, and wrap to the beginning when reaching the end.
+ *
+ * After recording the copy commands, call Retire() and submit with the returned fence.
+ * When the fence is signaled, GPU has finished reading all pieces allocated before Retire(),
+ * so these pieces can be reused. If the ring is full, Allocate() waits for the oldest fence.
+ *
+ * Positions are counted in total bytes from start(never wrap), so (head - tail) is the bytes in use.
+ *
+ * Every Retire() gets a serial number, others can use IsFinished()/WaitFinished() to know whether GPU
+ * finished that batch, because the fence itself will be reset and reused.
+ */
+struct StagingRegion {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    void* data = nullptr;
+};
+
+class StagingRing {
+ public:
+    // buffer must be created with TRANSFER_SRC usage, mapped points to its beginning
+    void Init(VkDevice device, VkBuffer buffer, void* mapped, VkDeviceSize capacity) {
+        device_ = device;
+        buffer_ = buffer;
+        mapped_ = static_cast<char*>(mapped);
+        capacity_ = capacity;
+        head_ = tail_ = 0;
+    }
+
+    StagingRegion Allocate(VkDeviceSize size, VkDeviceSize alignment = 16) {
+        assertm("staging ring is too small for this upload", size <= capacity_);
+
+        reclaim();
+        VkDeviceSize offset = alignUp(head_ % capacity_, alignment);
+        // don't split an upload at the end of ring, skip the tail and start from 0
+        if (offset + size > capacity_) {
+            offset = 0;
+        }
+        VkDeviceSize new_head = head_ - head_ % capacity_ + offset + size;
+        if (offset < head_ % capacity_) {
+            new_head += capacity_;
+        }
+
+        while (new_head - tail_ > capacity_) {
+            assertm("staging ring is full of uploads which are not retired", !pending_.empty());
+            Log("staging ring is full, wait GPU");
+            vkWaitForFences(device_, 1, &pending_.front().fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+            reclaim();
+        }
+
+        head_ = new_head;
+        StagingRegion region;
+        region.buffer = buffer_;
+        region.offset = offset;
+        region.data = mapped_ + offset;
+        return region;
+    }
+
+    // submit the copy commands with the returned fence, the ring don't reuse memory before it signaled
+    VkFence Retire() {
+        VkFence fence;
+        if (free_fences_.empty()) {
+            VkFenceCreateInfo create_info = {};
+            create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            assertm("create staging fence failed", vkCreateFence(device_, &create_info, nullptr, &fence) == VK_SUCCESS);
+        } else {
+            fence = free_fences_.back();
+            free_fences_.pop_back();
+        }
+        pending_.push_back({fence, head_, ++retired_serial_});
+        return fence;
+    }
+
+    VkDeviceSize Capacity() const {
+        return capacity_;
+    }
+
+    // serial of the last Retire()
+    uint64_t LastSerial() const {
+        return retired_serial_;
+    }
+
+    bool IsFinished(uint64_t serial) {
+        reclaim();
+        return serial <= finished_serial_;
+    }
+
+    void WaitFinished(uint64_t serial) {
+        assertm("wait a batch which is not retired", serial <= retired_serial_);
+        while (!IsFinished(serial)) {
+            vkWaitForFences(device_, 1, &pending_.front().fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+    }
+
+    void Destroy() {
+        for (auto& batch: pending_) {
+            vkWaitForFences(device_, 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+            vkDestroyFence(device_, batch.fence, nullptr);
+        }
+        pending_.clear();
+        for (auto fence: free_fences_) {
+            vkDestroyFence(device_, fence, nullptr);
+        }
+        free_fences_.clear();
+    }
+
+ private:
+    struct RetiredBatch {
+        VkFence fence;
+        VkDeviceSize end;   // head when retired
+        uint64_t serial;
+    };
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkBuffer buffer_ = VK_NULL_HANDLE;
+    char* mapped_ = nullptr;
+    VkDeviceSize capacity_ = 0;
+    VkDeviceSize head_ = 0;
+    VkDeviceSize tail_ = 0;
+    std::deque<RetiredBatch> pending_;
+    std::vector<VkFence> free_fences_;
+    uint64_t retired_serial_ = 0;
+    uint64_t finished_serial_ = 0;
+
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // move tail over all batches GPU has finished
+    void reclaim() {
+        while (!pending_.empty() && vkGetFenceStatus(device_, pending_.front().fence) == VK_SUCCESS) {
+            tail_ = pending_.front().end;
+            finished_serial_ = pending_.front().serial;
+            vkResetFences(device_, 1, &pending_.front().fence);
+            free_fences_.push_back(pending_.front().fence);
+            pending_.pop_front();
+        }
+        // nothing in flight, start from 0 again to keep uploads contiguous
+        if (pending_.empty() && tail_ == head_) {
+            head_ = tail_ = 0;
+        }
+    }
+};
+
+#endif
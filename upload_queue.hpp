@@ -0,0 +1,304 @@
+#ifndef UPLOAD_QUEUE_HPP
+#define UPLOAD_QUEUE_HPP
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "vulkan/vulkan.hpp"
+
+#include "log.hpp"
+#include "staging_ring.hpp"
+
+/*
+ * UploadQueue collects many buffer uploads and sends them to GPU in one command buffer.
+ *
+ * Enqueue() copies data into the staging ring and only remembers a VkBufferCopy, GPU does nothing yet.
+ * Flush() records all copies into one command buffer and submits it once with a fence.
+ *
+ * Both return a ticket, use IsDone(ticket) to poll or Wait(ticket) to block untill the data is on GPU.
+ * You don't need to wait before drawing with the buffers on the same queue, because each batch ends with
+ * a memory barrier which makes the transfer writes visible to later commands.
+ *
+ * If the upload queue is a dedicated transfer queue(DMA engine), call SetConsumerQueue() with the graphic queue.
+ * Then copies run on transfer queue and overlap with rendering. Because buffers are created with
+ * VK_SHARING_MODE_EXCLUSIVE, each batch releases the buffers from transfer queue family,
+ * and a small command buffer on graphic queue acquires them after a semaphore.
+ */
+struct UploadTicket {
+    uint64_t batch = 0;     // which Flush() the upload belongs to, start from 1
+};
+
+class UploadQueue {
+ public:
+    void Init(VkDevice device, VkQueue queue, uint32_t queue_family_idx, StagingRing& staging) {
+        device_ = device;
+        queue_ = queue;
+        staging_ = &staging;
+
+        VkCommandPoolCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        create_info.queueFamilyIndex = queue_family_idx;
+        assertm("create upload command pool failed", vkCreateCommandPool(device_, &create_info, nullptr, &commandpool_) == VK_SUCCESS);
+        queue_family_idx_ = queue_family_idx;
+    }
+
+    // the queue which reads the uploaded buffers, do nothing if it is in the same family as upload queue
+    void SetConsumerQueue(VkQueue queue, uint32_t queue_family_idx) {
+        if (queue_family_idx == queue_family_idx_) {
+            return;
+        }
+        consumer_queue_ = queue;
+        consumer_family_idx_ = queue_family_idx;
+
+        VkCommandPoolCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        create_info.queueFamilyIndex = queue_family_idx;
+        assertm("create acquire command pool failed", vkCreateCommandPool(device_, &create_info, nullptr, &acquire_commandpool_) == VK_SUCCESS);
+    }
+
+    UploadTicket Enqueue(VkBuffer dst, VkDeviceSize dst_offset, const void* data, VkDeviceSize size) {
+        // staging ring can't reuse memory of a batch which is not submitted, so don't let one batch eat the whole ring
+        if (pending_bytes_ + size > staging_->Capacity() / 2) {
+            Flush();
+        }
+        pending_bytes_ += size;
+
+        StagingRegion region = staging_->Allocate(size);
+        memcpy(region.data, data, size);
+
+        VkBufferCopy copy = {};
+        copy.srcOffset = region.offset;
+        copy.dstOffset = dst_offset;
+        copy.size = size;
+        pending_copies_.push_back({dst, copy});
+        staging_buffer_ = region.buffer;
+
+        // this upload will be in the next batch
+        return UploadTicket{submitted_batch_ + 1};
+    }
+
+    UploadTicket Flush() {
+        if (pending_copies_.empty()) {
+            return UploadTicket{submitted_batch_};
+        }
+        freeFinishedBatches();
+
+        VkCommandBuffer buffer = beginCommandBuffer(commandpool_);
+
+        // copies to the same buffer are adjacent after sorting, so we can send them in one vkCmdCopyBuffer
+        std::stable_sort(pending_copies_.begin(), pending_copies_.end(),
+                         [](const PendingCopy& a, const PendingCopy& b) { return a.dst < b.dst; });
+        std::vector<VkBufferCopy> regions;
+        std::vector<VkBuffer> dst_buffers;
+        for (size_t i = 0; i < pending_copies_.size(); i++) {
+            regions.push_back(pending_copies_.at(i).region);
+            if (i + 1 == pending_copies_.size() || pending_copies_.at(i + 1).dst != pending_copies_.at(i).dst) {
+                vkCmdCopyBuffer(buffer, staging_buffer_, pending_copies_.at(i).dst, static_cast<uint32_t>(regions.size()), regions.data());
+                dst_buffers.push_back(pending_copies_.at(i).dst);
+                regions.clear();
+            }
+        }
+
+        InflightBatch batch = {};
+        batch.command_buffer = buffer;
+        if (consumer_queue_ == VK_NULL_HANDLE) {
+            // make transfer writes visible to everything that reads buffers after this batch
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = ReadAccess;
+            vkCmdPipelineBarrier(buffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, ReadStages, 0,
+                                 1, &barrier,
+                                 0, nullptr,
+                                 0, nullptr);
+            vkEndCommandBuffer(buffer);
+
+            VkSubmitInfo submit_info = {};
+            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submit_info.commandBufferCount = 1;
+            submit_info.pCommandBuffers = &buffer;
+
+            VkFence fence = staging_->Retire();
+            assertm("submit uploads failed", vkQueueSubmit(queue_, 1, &submit_info, fence) == VK_SUCCESS);
+        } else {
+            submitWithOwnershipTransfer(batch, dst_buffers);
+        }
+
+        submitted_batch_++;
+        batch.batch = submitted_batch_;
+        batch.serial = staging_->LastSerial();
+        inflight_batches_.push_back(batch);
+        pending_copies_.clear();
+        pending_bytes_ = 0;
+        return UploadTicket{submitted_batch_};
+    }
+
+    bool IsDone(UploadTicket ticket) {
+        freeFinishedBatches();
+        return ticket.batch <= finished_batch_;
+    }
+
+    void Wait(UploadTicket ticket) {
+        if (ticket.batch > submitted_batch_) {
+            Flush();
+        }
+        for (auto& batch: inflight_batches_) {
+            if (batch.batch == ticket.batch) {
+                staging_->WaitFinished(batch.serial);
+                break;
+            }
+        }
+        freeFinishedBatches();
+    }
+
+    void Destroy() {
+        Flush();
+        if (!inflight_batches_.empty()) {
+            staging_->WaitFinished(inflight_batches_.back().serial);
+        }
+        freeFinishedBatches();
+        vkDestroyCommandPool(device_, commandpool_, nullptr);
+        if (acquire_commandpool_ != VK_NULL_HANDLE) {
+            vkDestroyCommandPool(device_, acquire_commandpool_, nullptr);
+        }
+        for (auto semaphore: free_semaphores_) {
+            vkDestroySemaphore(device_, semaphore, nullptr);
+        }
+        free_semaphores_.clear();
+    }
+
+ private:
+    struct PendingCopy {
+        VkBuffer dst;
+        VkBufferCopy region;
+    };
+
+    struct InflightBatch {
+        uint64_t batch;
+        uint64_t serial;    // staging ring serial
+        VkCommandBuffer command_buffer;
+        // only used when transfering ownership to consumer queue
+        VkCommandBuffer acquire_command_buffer;
+        VkSemaphore semaphore;
+    };
+
+    static constexpr VkAccessFlags ReadAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT|VK_ACCESS_INDEX_READ_BIT|VK_ACCESS_UNIFORM_READ_BIT|VK_ACCESS_SHADER_READ_BIT;
+    static constexpr VkPipelineStageFlags ReadStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT|VK_PIPELINE_STAGE_VERTEX_SHADER_BIT|VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT|VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    VkDevice device_ = VK_NULL_HANDLE;
+    VkQueue queue_ = VK_NULL_HANDLE;
+    uint32_t queue_family_idx_ = 0;
+    VkCommandPool commandpool_ = VK_NULL_HANDLE;
+    VkQueue consumer_queue_ = VK_NULL_HANDLE;
+    uint32_t consumer_family_idx_ = 0;
+    VkCommandPool acquire_commandpool_ = VK_NULL_HANDLE;
+    std::vector<VkSemaphore> free_semaphores_;
+    VkBuffer staging_buffer_ = VK_NULL_HANDLE;
+    StagingRing* staging_ = nullptr;
+    std::vector<PendingCopy> pending_copies_;
+    std::deque<InflightBatch> inflight_batches_;
+    VkDeviceSize pending_bytes_ = 0;
+    uint64_t submitted_batch_ = 0;
+    uint64_t finished_batch_ = 0;
+
+    void freeFinishedBatches() {
+        while (!inflight_batches_.empty() && staging_->IsFinished(inflight_batches_.front().serial)) {
+            finished_batch_ = inflight_batches_.front().batch;
+            auto& batch = inflight_batches_.front();
+            vkFreeCommandBuffers(device_, commandpool_, 1, &batch.command_buffer);
+            if (batch.acquire_command_buffer != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(device_, acquire_commandpool_, 1, &batch.acquire_command_buffer);
+                free_semaphores_.push_back(batch.semaphore);
+            }
+            inflight_batches_.pop_front();
+        }
+    }
+
+    VkCommandBuffer beginCommandBuffer(VkCommandPool pool) {
+        VkCommandBufferAllocateInfo allocate_info = {};
+        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocate_info.commandPool = pool;
+        allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocate_info.commandBufferCount = 1;
+
+        VkCommandBuffer buffer;
+        assertm("allocate upload command buffer failed", vkAllocateCommandBuffers(device_, &allocate_info, &buffer) == VK_SUCCESS);
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(buffer, &begin_info);
+        return buffer;
+    }
+
+    // release barrier on upload queue -> semaphore -> acquire barrier on consumer queue
+    void submitWithOwnershipTransfer(InflightBatch& batch, const std::vector<VkBuffer>& dst_buffers) {
+        std::vector<VkBufferMemoryBarrier> barriers(dst_buffers.size());
+        for (size_t i = 0; i < dst_buffers.size(); i++) {
+            VkBufferMemoryBarrier& barrier = barriers.at(i);
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;  // ignored by release
+            barrier.srcQueueFamilyIndex = queue_family_idx_;
+            barrier.dstQueueFamilyIndex = consumer_family_idx_;
+            barrier.buffer = dst_buffers.at(i);
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+        }
+        vkCmdPipelineBarrier(batch.command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data(),
+                             0, nullptr);
+        vkEndCommandBuffer(batch.command_buffer);
+
+        if (free_semaphores_.empty()) {
+            VkSemaphoreCreateInfo create_info = {};
+            create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            assertm("create upload semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &batch.semaphore) == VK_SUCCESS);
+        } else {
+            batch.semaphore = free_semaphores_.back();
+            free_semaphores_.pop_back();
+        }
+
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &batch.command_buffer;
+        submit_info.signalSemaphoreCount = 1;
+        submit_info.pSignalSemaphores = &batch.semaphore;
+        assertm("submit uploads failed", vkQueueSubmit(queue_, 1, &submit_info, VK_NULL_HANDLE) == VK_SUCCESS);
+
+        // the acquire barrier must be in the semaphore wait stages, so they are chained
+        batch.acquire_command_buffer = beginCommandBuffer(acquire_commandpool_);
+        for (auto& barrier: barriers) {
+            barrier.srcAccessMask = 0;  // ignored by acquire
+            barrier.dstAccessMask = ReadAccess;
+        }
+        vkCmdPipelineBarrier(batch.acquire_command_buffer,
+                             ReadStages, ReadStages, 0,
+                             0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data(),
+                             0, nullptr);
+        vkEndCommandBuffer(batch.acquire_command_buffer);
+
+        VkPipelineStageFlags wait_stage = ReadStages;
+        VkSubmitInfo acquire_info = {};
+        acquire_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        acquire_info.waitSemaphoreCount = 1;
+        acquire_info.pWaitSemaphores = &batch.semaphore;
+        acquire_info.pWaitDstStageMask = &wait_stage;
+        acquire_info.commandBufferCount = 1;
+        acquire_info.pCommandBuffers = &batch.acquire_command_buffer;
+
+        // the fence signals after consumer queue acquired the buffers, which means copies are finished too
+        VkFence fence = staging_->Retire();
+        assertm("submit acquire failed", vkQueueSubmit(consumer_queue_, 1, &acquire_info, fence) == VK_SUCCESS);
+    }
+};
+
+#endif
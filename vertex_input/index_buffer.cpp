@@ -1,12 +1,14 @@
 #include <string>
 #include <vector>
-#include <iostream>
 #include <optional>
 #include <array>
 #include <set>
-#include <streambuf>
-#include <fstream>
 #include <limits>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
 
 #include "vulkan/vulkan.hpp"
 #include "SDL.h"
@@ -14,10 +16,32 @@
 #include "glm/glm.hpp"
 
 #include "log.hpp"
+#include "frame_pacer.hpp"
+#include "memory_allocator.hpp"
+#include "staging_ring.hpp"
+#include "upload_queue.hpp"
+#include "pipeline_cache.hpp"
+#include "frame_command_pool.hpp"
+#include "job_system.hpp"
+#include "init_graph.hpp"
+#include "shader_loader.hpp"
+#include "frustum_culler.hpp"
+#include "particle_system.hpp"
+#include "descriptor_allocator.hpp"
+#include "dynamic_uniform_buffer.hpp"
+#include "bindless_table.hpp"
+#include "offscreen_target.hpp"
+#include "gpu_profiler.hpp"
+#include "cpu_profiler.hpp"
 #include "vulkan/vulkan_core.h"
 
-using std::cout;
-using std::endl;
+// generated by make from the nine shaders in shader/(see the Makefile rule), if it is there shaders come from the binary.
+// otherwise, or when built with -DNO_EMBEDDED_SHADERS(make index_buffer_spv.out), they are loaded from shader/*.spv
+#if !defined(NO_EMBEDDED_SHADERS) && __has_include("shader/embedded_shaders.hpp")
+#include "shader/embedded_shaders.hpp"
+#define EMBEDDED_SHADERS
+#endif
+
 using std::vector;
 using std::optional;
 using std::string;
@@ -34,23 +58,76 @@ constexpr bool EnableValidation = true;
 constexpr bool EnableValidation = false;
 #endif
 
+// how many frames CPU can record ahead of GPU, change it by -DMAX_FRAMES_IN_FLIGHT=N
+#ifndef MAX_FRAMES_IN_FLIGHT
+#define MAX_FRAMES_IN_FLIGHT 2
+#endif
+
+constexpr int MaxFramesInFlight = MAX_FRAMES_IN_FLIGHT;
+
+// only the first draws get their own GPU timestamps, or they use up the queries of a frame
+constexpr uint32_t MaxProfiledDraws = 16;
+
+// every frame in flight has an instance buffer of this many instances, enough for 100k quads benchmark
+constexpr uint32_t MaxInstances = 128 * 1024;
+
+// every frame in flight has an indirect buffer of this many VkDrawIndexedIndirectCommand
+constexpr uint32_t MaxIndirectDraws = 128 * 1024;
+// indirect buffer starts with the draw count for vkCmdDrawIndexedIndirectCountKHR, commands follow it
+constexpr VkDeviceSize IndirectCommandsOffset = 16;
+
+// every frame in flight has room for this many objects in the dynamic uniform buffer,
+// each takes minUniformBufferOffsetAlignment bytes(up to 256)
+constexpr uint32_t MaxObjects = 16 * 1024;
+
+// particles move this long every frame, fixed so headless runs give the same picture every time
+constexpr float ParticleTimeStep = 1.0f / 60.0f;
+
+// all uploads share one staging buffer of this size
+constexpr VkDeviceSize StagingRingSize = 4 * 1024 * 1024;
+
+// record how long CPU blocks on GPU fences, print the result once per second
+struct FrameOverlapStats {
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point report_begin = Clock::now();
+    uint32_t frame_count = 0;
+    double fence_wait_ms = 0;
+    double record_ms = 0;
+
+    void AddFrame(double wait_ms, double record_frame_ms) {
+        frame_count++;
+        fence_wait_ms += wait_ms;
+        record_ms += record_frame_ms;
+
+        double elapse_ms = std::chrono::duration<double, std::milli>(Clock::now() - report_begin).count();
+        if (elapse_ms >= 1000.0) {
+            double frame_ms = elapse_ms / frame_count;
+            double wait_ms_per_frame = fence_wait_ms / frame_count;
+            // the time CPU don't wait for GPU is the time they work together
+            Log("fps: %u, cpu frame: %.3fms, wait gpu: %.3fms, record: %.3fms, overlap: %.1f%%",
+                frame_count, frame_ms, wait_ms_per_frame, record_ms / frame_count,
+                100.0 * (1.0 - wait_ms_per_frame / frame_ms));
+            report_begin = Clock::now();
+            frame_count = 0;
+            fence_wait_ms = 0;
+            record_ms = 0;
+        }
+    }
+};
+
 struct QueueFamilyIdx {
     optional<uint32_t> present_queue_idx;
     optional<uint32_t> graphic_queue_idx;
+    // these two fall back to graphic_queue_idx if GPU has no dedicated family
+    optional<uint32_t> transfer_queue_idx;
+    optional<uint32_t> compute_queue_idx;
 
     bool Valid() {
         return present_queue_idx.has_value() && graphic_queue_idx.has_value();
     }
 };
 
-string ReadShader(string filename) {
-    std::ifstream file(filename, std::ios::binary);
-    assertm((filename + " can't be open").c_str(), !file.fail());
-    string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
-    return content;
-}
-
 struct Vertex {
     glm::vec2 pos;
     glm::vec3 color;
@@ -82,6 +159,64 @@ struct Vertex {
     }
 };
 
+// per instance attributes, vertex shader reads them once per quad instead of once per vertex.
+// cull.comp reads them as std430 struct too, so it is padded to 32 bytes
+struct InstanceData {
+    glm::vec4 transform;    // xy is offset, zw is scale
+    glm::vec3 color;        // multiplied with vertex color
+    float padding;
+
+    static VkVertexInputBindingDescription GetBindingDescriptions() {
+        VkVertexInputBindingDescription description = {};
+        description.binding = 1;
+        description.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+        description.stride = sizeof(InstanceData);
+        return description;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 2> GetAttribDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> descriptions;
+
+        // for inTransform attribute
+        descriptions[0].binding = 1;
+        descriptions[0].location = 2;
+        descriptions[0].offset = offsetof(InstanceData, transform);
+        descriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+
+        // for inInstanceColor attribute
+        descriptions[1].binding = 1;
+        descriptions[1].location = 3;
+        descriptions[1].offset = offsetof(InstanceData, color);
+        descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+
+        return descriptions;
+    }
+};
+
+// what object.vert reads from its dynamic offset(std140), and push.vert from push constants.
+// 84 bytes, push constants have at least 128
+struct ObjectUniform {
+    glm::mat4 model;
+    glm::vec4 color;        // tint, multiplied with vertex color
+    uint32_t material;      // no materials yet, always 0
+};
+
+// where object draws get their transform from
+enum class ObjectPath {
+    DynamicUniform,     // object.vert, a dynamic offset into object uniforms for each draw
+    PushConstant,       // push.vert, the whole ObjectUniform is pushed for each draw
+    Bindless,           // bindless.vert, indices of instance buffer and instance are pushed for each draw
+};
+
+const char* ObjectPathName(ObjectPath path) {
+    switch (path) {
+        case ObjectPath::DynamicUniform: return "dynamic uniform offsets";
+        case ObjectPath::PushConstant: return "push constants";
+        case ObjectPath::Bindless: return "bindless indices";
+    }
+    return "";
+}
+
 const vector<Vertex> RectVertices = {
     {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
     {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
@@ -93,9 +228,19 @@ const vector<uint16_t> RectIndices = {
     0, 1, 2, 2, 3, 0
 };
 
+// one vkCmdDrawIndexed of the draw list
+struct DrawItem {
+    uint32_t index_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t instance_count;
+    uint32_t first_instance;
+};
+
 class App {
  public:
-    App():should_close_(false) {
+    // headless renders into an offscreen image without window, surface or swapchain
+    App(bool headless = false):should_close_(false), headless_(headless) {
         initSDL();
         initVulkan();
     }
@@ -106,7 +251,9 @@ class App {
     }
 
     void SetTitle(std::string title) {
-        SDL_SetWindowTitle(window_, title.c_str());
+        if (window_) {
+            SDL_SetWindowTitle(window_, title.c_str());
+        }
     }
 
     void Exit() {
@@ -117,12 +264,376 @@ class App {
         return should_close_;
     }
 
+    // upload count small buffers one by one with blocking copies, then with upload queue, print the time of both
+    void BenchmarkUpload(uint32_t count) {
+        using Clock = std::chrono::steady_clock;
+
+        constexpr VkDeviceSize size = 256;
+        vector<uint8_t> data(size, 0xff);
+        vector<VkBuffer> buffers(count);
+        vector<Allocation> memories(count);
+        for (uint32_t i = 0; i < count; i++) {
+            createBuffer(size,
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         buffers.at(i), memories.at(i), "benchmark buffer");
+        }
+
+        auto begin = Clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            StagingRegion staging = staging_ring_.Allocate(size);
+            memcpy(staging.data, data.data(), size);
+            copyBufferBlocking(staging, buffers.at(i), size);
+        }
+        double blocking_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+        begin = Clock::now();
+        for (uint32_t i = 0; i < count; i++) {
+            upload_queue_.Enqueue(buffers.at(i), 0, data.data(), size);
+        }
+        upload_queue_.Wait(upload_queue_.Flush());
+        double batched_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+        Log("upload %u buffers of %llu bytes: blocking %.3fms, batched %.3fms, %.1fx faster",
+            count, static_cast<unsigned long long>(size), blocking_ms, batched_ms, blocking_ms / batched_ms);
+
+        for (uint32_t i = 0; i < count; i++) {
+            vkDestroyBuffer(device_, buffers.at(i), nullptr);
+            allocator_.Free(memories.at(i));
+        }
+    }
+
+    // command buffers are recorded again every frame from draw_list_, so changes show up in next frame
+    void ClearDraws() {
+        draw_list_.clear();
+    }
+
+    // first_instance indexes instances_
+    void AddDraw(uint32_t index_count, uint32_t first_index = 0, int32_t vertex_offset = 0,
+                 uint32_t instance_count = 1, uint32_t first_instance = 0) {
+        draw_list_.push_back({index_count, first_index, vertex_offset, instance_count, first_instance});
+    }
+
+    // instances are copied into the frame's instance buffer every frame, so changes show up in next frame
+    void SetInstances(const vector<InstanceData>& instances) {
+        assertm("too many instances", instances.size() <= MaxInstances);
+        instances_ = instances;
+    }
+
+    // count quads in a grid covering the window, drawn by one instanced draw
+    void DrawInstancedGrid(uint32_t count) {
+        SetInstances(makeGrid(count));
+        ClearDraws();
+        AddDraw(RectIndices.size(), 0, 0, count, 0);
+    }
+
+    // count quads in a grid covering the window, each is its own draw with its own uniforms.
+    // transforms are written into the dynamic uniform buffer every frame, draws only change the dynamic offset
+    // other paths push them into the command buffer before each draw instead, see ObjectPath.
+    // without descriptor indexing, Bindless falls back to DynamicUniform
+    void DrawObjects(uint32_t count, ObjectPath path = ObjectPath::DynamicUniform) {
+        assertm("too many objects", count <= MaxObjects);
+        if (path == ObjectPath::Bindless && !bindless_supported_) {
+            Log("bindless is not supported, draw objects with %s", ObjectPathName(ObjectPath::DynamicUniform));
+            path = ObjectPath::DynamicUniform;
+        }
+        object_path_ = path;
+        SetInstances(makeGrid(count));
+        ClearDraws();
+        for (uint32_t i = 0; i < count; i++) {
+            AddDraw(RectIndices.size(), 0, 0, 1, i);
+        }
+        objects_ = true;
+        indirect_ = false;
+        culling_ = false;
+    }
+
+    // draw count quads one draw each with transforms from dynamic uniform buffer, then from push constants,
+    // then from the bindless table if it is supported.
+    // print CPU recording time(with writing the uniforms) and GPU render pass time of each
+    void BenchmarkObjects(uint32_t count) {
+        using Clock = std::chrono::steady_clock;
+        constexpr int Frames = 128;
+        constexpr int Iterations = 20;
+
+        vkDeviceWaitIdle(device_);
+        vector<DrawItem> saved_list = draw_list_;
+        vector<InstanceData> saved_instances = instances_;
+        bool saved_objects = objects_;
+        ObjectPath saved_path = object_path_;
+        bool saved_indirect = indirect_;
+        bool saved_culling = culling_;
+
+        vector<ObjectPath> paths = {ObjectPath::DynamicUniform, ObjectPath::PushConstant};
+        if (bindless_supported_) {
+            paths.push_back(ObjectPath::Bindless);
+        }
+        vector<double> cpu_ms(paths.size()), gpu_ms(paths.size());
+        for (size_t p = 0; p < paths.size(); p++) {
+            DrawObjects(count, paths.at(p));
+
+            auto begin = Clock::now();
+            for (int i = 0; i < Iterations; i++) {
+                if (paths.at(p) == ObjectPath::DynamicUniform) {
+                    writeObjectUniforms(0);
+                }
+                resetFrame(0);
+                recordFrame(frame_pool_.Get(0), 0, 0);
+            }
+            cpu_ms.at(p) = std::chrono::duration<double, std::milli>(Clock::now() - begin).count() / Iterations;
+            resetFrame(0);
+
+            for (int i = 0; i < Frames && !ShouldClose(); i++) {
+                if (!headless_) {
+                    pollEvent();
+                }
+                drawFrame();
+            }
+            vkDeviceWaitIdle(device_);
+            gpu_ms.at(p) = gpu_profiler_.AverageMs("render pass");
+            Log("%u draws with %s: record %.3fms, gpu %.3fms", count, ObjectPathName(paths.at(p)), cpu_ms.at(p), gpu_ms.at(p));
+        }
+        for (size_t p = 1; p < paths.size(); p++) {
+            Log("%s: record %.2fx, gpu %.2fx of dynamic uniform buffer",
+                ObjectPathName(paths.at(p)), cpu_ms.at(p) / cpu_ms.at(0), gpu_ms.at(p) / gpu_ms.at(0));
+        }
+
+        draw_list_ = saved_list;
+        instances_ = saved_instances;
+        objects_ = saved_objects;
+        object_path_ = saved_path;
+        indirect_ = saved_indirect;
+        culling_ = saved_culling;
+    }
+
+    // draw count quads as count draws of one instance, then as one draw of count instances.
+    // print CPU recording time and GPU render pass time of both
+    void BenchmarkInstancing(uint32_t count) {
+        using Clock = std::chrono::steady_clock;
+        // more than GpuProfiler's rolling average, so it only has frames of one mode
+        constexpr int Frames = 128;
+        constexpr int Iterations = 20;
+
+        vkDeviceWaitIdle(device_);
+        vector<DrawItem> saved_list = draw_list_;
+        vector<InstanceData> saved_instances = instances_;
+        bool saved_culling = culling_;
+        culling_ = false;
+        SetInstances(makeGrid(count));
+
+        double cpu_ms[2], gpu_ms[2];
+        for (int instanced = 0; instanced < 2; instanced++) {
+            ClearDraws();
+            if (instanced) {
+                AddDraw(RectIndices.size(), 0, 0, count, 0);
+            } else {
+                for (uint32_t i = 0; i < count; i++) {
+                    AddDraw(RectIndices.size(), 0, 0, 1, i);
+                }
+            }
+
+            auto begin = Clock::now();
+            for (int i = 0; i < Iterations; i++) {
+                resetFrame(0);
+                recordFrame(frame_pool_.Get(0), 0, 0);
+            }
+            cpu_ms[instanced] = std::chrono::duration<double, std::milli>(Clock::now() - begin).count() / Iterations;
+            resetFrame(0);
+
+            for (int i = 0; i < Frames && !ShouldClose(); i++) {
+                if (!headless_) {
+                    pollEvent();
+                }
+                drawFrame();
+            }
+            vkDeviceWaitIdle(device_);
+            gpu_ms[instanced] = gpu_profiler_.AverageMs("render pass");
+            Log("%u quads %s: record %.3fms, gpu %.3fms",
+                count, instanced ? "in one instanced draw" : "in one draw each", cpu_ms[instanced], gpu_ms[instanced]);
+        }
+        Log("instancing: record %.1fx faster, gpu %.1fx faster", cpu_ms[0] / cpu_ms[1], gpu_ms[0] / gpu_ms[1]);
+
+        draw_list_ = saved_list;
+        instances_ = saved_instances;
+        culling_ = saved_culling;
+    }
+
+    // reset the frame pool and record draw lists of growing size, print CPU time of each size.
+    // nothing is submitted, so only recording cost is measured
+    void BenchmarkRecording(uint32_t max_draws) {
+        using Clock = std::chrono::steady_clock;
+        constexpr int Iterations = 100;
+
+        vkDeviceWaitIdle(device_);
+        vector<DrawItem> saved_list = draw_list_;
+        bool saved_indirect = indirect_;
+        bool saved_culling = culling_;
+        culling_ = false;
+        for (uint32_t count = 1; count <= max_draws; count *= 10) {
+            ClearDraws();
+            for (uint32_t i = 0; i < count; i++) {
+                AddDraw(RectIndices.size());
+            }
+
+            double frame_ms[2];
+            for (int indirect = 0; indirect < 2; indirect++) {
+                indirect_ = indirect;
+                auto begin = Clock::now();
+                for (int i = 0; i < Iterations; i++) {
+                    resetFrame(0);
+                    if (indirect_) {
+                        writeIndirectCommands(0);
+                    }
+                    recordFrame(frame_pool_.Get(0), 0, 0);
+                }
+                frame_ms[indirect] = std::chrono::duration<double, std::milli>(Clock::now() - begin).count() / Iterations;
+            }
+            Log("record %u draws: %.3fms per frame, %.3fus per draw, indirect %.3fms per frame",
+                count, frame_ms[0], frame_ms[0] * 1000.0 / count, frame_ms[1]);
+        }
+        resetFrame(0);
+        draw_list_ = saved_list;
+        indirect_ = saved_indirect;
+        culling_ = saved_culling;
+    }
+
+    // indirect mode writes draw list into a buffer every frame, and records one indirect draw for all of it
+    void SetIndirect(bool indirect) {
+        indirect_ = indirect;
+        Log("indirect draws %s, %s", indirect ? "on" : "off",
+            cmd_draw_indexed_indirect_count_ ? "draw count from buffer" :
+            enabled_features_.multiDrawIndirect ? "multi draw indirect" : "one indirect call per draw");
+    }
+
+    // culling draws instances_ with one indirect draw, a compute shader decides which of them are visible.
+    // draw list is not used
+    void SetCulling(bool culling) {
+        culling_ = culling;
+        indirect_ = culling || indirect_;
+    }
+
+    // count quads on a grid 3 times as wide and high as the window, so only about 1/9 of them are visible
+    void CullScene(uint32_t count) {
+        SetInstances(makeGrid(count, 3.0f));
+        SetCulling(true);
+    }
+
+    // count particles simulated by a compute shader every frame, drawn as points over the quads
+    void EnableParticles(uint32_t count) {
+        assertm("particle count must not be 0", count > 0);
+        vkDeviceWaitIdle(device_);
+        destroyParticleBuffers();
+
+        // async compute reads and writes them on another queue family, share them instead of transfering ownership
+        vector<uint32_t> families;
+        if (particles_.Async()) {
+            families = {queue_family_idx_.graphic_queue_idx.value(), queue_family_idx_.compute_queue_idx.value()};
+        }
+        particle_buffers_.resize(MaxFramesInFlight);
+        particle_memories_.resize(MaxFramesInFlight);
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            createBuffer(sizeof(Particle) * count,
+                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         particle_buffers_.at(i), particle_memories_.at(i), "particle buffer", families);
+        }
+        particles_.SetBuffers(particle_buffers_, count);
+    }
+
+    // simulate count particles for steps steps without drawing, print particles per second
+    void BenchmarkParticles(uint32_t count, uint32_t steps) {
+        EnableParticles(count);
+        particles_.Benchmark(steps);
+    }
+
+    // 1 records draws on main thread into the primary buffer,
+    // more splits the draw list to this many jobs recording secondary buffers on worker threads
+    void SetRecordThreads(uint32_t count) {
+        record_threads_ = std::clamp<uint32_t>(count, 1, jobs_.ThreadCount());
+    }
+
+    // record the same draw list with 1 to all worker threads, print time and speedup of each
+    void BenchmarkRecordingThreads(uint32_t draw_count) {
+        using Clock = std::chrono::steady_clock;
+        constexpr int Iterations = 50;
+
+        vkDeviceWaitIdle(device_);
+        vector<DrawItem> saved_list = draw_list_;
+        uint32_t saved_threads = record_threads_;
+        ClearDraws();
+        for (uint32_t i = 0; i < draw_count; i++) {
+            AddDraw(RectIndices.size());
+        }
+
+        double single_ms = 0;
+        for (uint32_t threads = 1; threads <= jobs_.ThreadCount(); threads++) {
+            SetRecordThreads(threads);
+            auto begin = Clock::now();
+            for (int i = 0; i < Iterations; i++) {
+                resetFrame(0);
+                recordFrame(frame_pool_.Get(0), 0, 0);
+            }
+            double frame_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count() / Iterations;
+            if (threads == 1) {
+                single_ms = frame_ms;
+            }
+            Log("record %u draws with %u threads: %.3fms per frame, %.2fx", draw_count, threads, frame_ms, single_ms / frame_ms);
+        }
+        resetFrame(0);
+        draw_list_ = saved_list;
+        record_threads_ = saved_threads;
+    }
+
+    // write GPU time of every scope of every frame to path
+    bool OpenGpuCSV(const string& path) {
+        return gpu_profiler_.OpenCSV(path);
+    }
+
+    // override the present mode pacing, useful to compare latency and CPU usage
+    void SetPaceMode(PaceMode mode, double target_fps) {
+        pacer_.SetMode(mode, target_fps);
+    }
+
+    // draw frame_count frames offscreen, print throughput, then check and save the last frame.
+    // return false if nothing is drawn at the center of the image
+    bool RunHeadless(uint32_t frame_count, const string& output) {
+        using Clock = std::chrono::steady_clock;
+        assertm("RunHeadless() needs a headless App", headless_);
+
+        auto begin = Clock::now();
+        for (uint32_t i = 0; i < frame_count; i++) {
+            drawFrame();
+            pacer_.Wait();
+        }
+        vkDeviceWaitIdle(device_);
+        double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        pacer_.Report();
+        gpu_profiler_.Report();
+        reportCulling();
+        Log("headless: %u frames in %.3fs, %.1f fps", frame_count, seconds, frame_count / seconds);
+
+        // the corner only has clear color, the center should be covered by what we draw
+        VkExtent2D extent = offscreen_.Extent();
+        auto corner = offscreen_.Pixel(0, 0);
+        auto center = offscreen_.Pixel(extent.width / 2, extent.height / 2);
+        Log("corner pixel = (%u, %u, %u, %u), center pixel = (%u, %u, %u, %u)",
+            corner[0], corner[1], corner[2], corner[3],
+            center[0], center[1], center[2], center[3]);
+        if (offscreen_.SavePPM(output)) {
+            Log("last frame saved to %s", output.c_str());
+        }
+        return center != corner;
+    }
+
     void Run() {
         while (!ShouldClose()) {
             pollEvent();
             drawFrame();
-            SDL_Delay(60);
+            pacer_.Wait();
         }
+        pacer_.Report();
+        gpu_profiler_.Report();
+        reportCulling();
         vkDeviceWaitIdle(device_);
     }
 
@@ -130,23 +641,36 @@ class App {
     SDL_Window* window_;
     SDL_Event event;
     bool should_close_;
+    bool headless_;
+    FramePacer pacer_;
+    // window state read on main thread by queryWindow(), init steps on workers use these instead of SDL
+    VkExtent2D drawable_size_ = {WindowWidth, WindowHeight};
+    double refresh_rate_ = 60;
 
     void initSDL() {
+        if (headless_) {
+            window_ = nullptr;
+            return;
+        }
         SDL_Init(SDL_INIT_EVERYTHING);
         window_ = SDL_CreateWindow(
                 "",
                 SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
                 WindowWidth, WindowHeight,
-                SDL_WINDOW_SHOWN|SDL_WINDOW_VULKAN
+                SDL_WINDOW_SHOWN|SDL_WINDOW_VULKAN|SDL_WINDOW_RESIZABLE
                 );
         assertm("can't create window", window_ != nullptr);
     }
 
     void pollEvent() {
+        PROFILE_FUNCTION();
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 Exit();
             }
+            if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                framebuffer_resized_ = true;
+            }
         }
     }
 
@@ -158,59 +682,245 @@ class App {
     VkInstance instance_;
     VkPhysicalDevice physical_device_;
     VkSurfaceKHR surface_;
+    OffscreenTarget offscreen_;     // used instead of swapchain in headless mode
     VkDevice device_;
     VkQueue graphic_queue_;
     VkQueue present_queue_;
+    VkQueue transfer_queue_;
+    VkQueue compute_queue_;
     VkCommandPool commandpool_;
-    VkSwapchainKHR swapchain_;
-    vector<VkCommandBuffer> command_buffers_;
+    VkSwapchainKHR swapchain_ = VK_NULL_HANDLE;
+    VkExtent2D swapchain_extent_;
+    bool framebuffer_resized_ = false;
+    FrameCommandPool frame_pool_;   // thread 0 is main thread, thread i + 1 is worker i
+    JobSystem jobs_;
+    uint32_t record_threads_ = 1;
+    vector<DrawItem> draw_list_;
+    vector<InstanceData> instances_ = {{{0, 0, 1, 1}, {1, 1, 1}}};
+    vector<VkBuffer> instance_buffers_;     // one for each frame in flight, mapped forever
+    vector<Allocation> instance_memories_;
+    bool indirect_ = false;
+    vector<VkBuffer> indirect_buffers_;     // one for each frame in flight, mapped forever
+    vector<Allocation> indirect_memories_;
+    bool culling_ = false;
+    FrustumCuller culler_;
+    VkShaderModule cull_module_;
+    vector<VkBuffer> culled_buffers_;       // visible instances written by culler_, one for each frame in flight
+    vector<Allocation> culled_memories_;
+    uint32_t visible_instances_ = 0;        // result of the last finished frame
+    bool objects_ = false;
+    DynamicUniformBuffer object_uniforms_;  // one ObjectUniform for each draw, written every frame
+    VkBuffer object_buffer_;
+    Allocation object_memory_;
+    VkDescriptorSetLayout object_layout_;
+    VkShaderModule object_vert_module_;
+    VkPipeline object_pipeline_;            // reads transforms from object_uniforms_ instead of instance attributes
+    ObjectPath object_path_ = ObjectPath::DynamicUniform;
+    VkShaderModule object_push_vert_module_;
+    VkPipeline object_push_pipeline_;       // reads transforms from push constants
+    // from VK_EXT_descriptor_indexing, only created if bindless_supported_
+    bool bindless_supported_ = false;
+    BindlessTable bindless_;
+    BindlessTable::Sizes bindless_sizes_;   // clamped to the device limits by queryDescriptorIndexing()
+    VkShaderModule bindless_vert_module_;
+    VkPipelineLayout bindless_pipeline_layout_;
+    VkPipeline bindless_pipeline_;          // reads transforms from instance buffers in bindless_
+    vector<uint32_t> bindless_instance_idx_;    // index of each frame's instance buffer in bindless_
+    vector<uint32_t> object_offsets_;       // dynamic offset of the first object of each frame
+    ParticleSystem particles_;
+    VkShaderModule particle_comp_module_;
+    VkShaderModule particle_vert_module_;
+    VkPipeline particle_pipeline_;          // draws particle buffers as points, shares pipeline_layout_
+    vector<VkBuffer> particle_buffers_;     // created by EnableParticles(), one for each frame in flight
+    vector<Allocation> particle_memories_;
+    VkPhysicalDeviceFeatures enabled_features_ = {};
+    // from VK_KHR_draw_indirect_count, nullptr if the device don't support it
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmd_draw_indexed_indirect_count_ = nullptr;
+    GpuProfiler gpu_profiler_;
+    DescriptorLayoutCache descriptor_layouts_;
+    DescriptorAllocator descriptor_allocator_;   // sets which are written again every frame
     vector<VkImage> images_;
     vector<VkImageView> imageviews_;
+    PipelineCache pipeline_cache_;
     VkPipeline pipeline_;
     VkPipelineLayout pipeline_layout_;
     VkRenderPass renderpass_;
     vector<VkFramebuffer> framebuffers_;
-    VkSemaphore image_avaliable_semaphore_;
-    VkSemaphore present_finish_semaphore_;
+    vector<VkSemaphore> image_avaliable_semaphores_;
+    vector<VkSemaphore> present_finish_semaphores_;
+    vector<VkFence> inflight_fences_;
+    vector<VkFence> images_inflight_;   // which frame's fence is using the swapchain image
+    int current_frame_ = 0;
+    FrameOverlapStats overlap_stats_;
+    MemoryAllocator allocator_;
+    VkBuffer staging_buffer_;
+    Allocation staging_memory_;
+    StagingRing staging_ring_;
+    UploadQueue upload_queue_;
     VkBuffer vertex_buffer_;
-    VkDeviceMemory vertex_buf_memory_;
+    Allocation vertex_buf_memory_;
     VkBuffer index_buffer_;
-    VkDeviceMemory index_buf_memory_;
-
+    Allocation index_buf_memory_;
+    ShaderLoader shader_loader_;
+    VkShaderModule vert_module_;
+    VkShaderModule frag_module_;
+
+    // physical device and surface never change, so these are queried once in cacheDeviceQueries().
+    // surface capabilities are not here, their currentExtent changes with the window
+    QueueFamilyIdx queue_family_idx_;
+    VkSurfaceFormatKHR surface_format_;
+    VkPresentModeKHR present_mode_;
+    VkPhysicalDeviceMemoryProperties mem_properties_;
+    VkPhysicalDeviceFeatures supported_features_;
+    VkPhysicalDeviceProperties device_properties_;
+
+    // steps run on worker threads as soon as the steps they depend on finished, see init_graph.hpp.
+    // steps which may run at the same time must not share objects:
+    // MemoryAllocator has no lock, and every step calling createBuffer() uses allocator_: staging ring,
+    // upload buffers, instance buffers, indirect buffers and object uniforms. only the graph edges keep them apart,
+    // staging ring -> upload queue -> upload buffers -> instance buffers -> indirect buffers -> object uniforms
+    // each depends on the one before. a new step creating buffers must be put into this chain too.
+    // SDL window functions are only called on main thread, so instance and surface are created
+    // before the graph runs and steps read the window state cached by queryWindow()
     void initVulkan() {
+        PROFILE_FUNCTION();
+        jobs_.Init(std::max(1u, std::thread::hardware_concurrency()));
+        Log("start %u worker threads", jobs_.ThreadCount());
+
         createInstance();
-        Log("created instance");
-        pickupPhysicalDevice();
-        Log("pick up physical device");
         createSurface();
-        Log("create surface");
-        createLogicDevice();
-        Log("create logic device");
-        createCommandPool();
-        Log("create command pool");
-        createSwapchain();
-        Log("create swapchain");
-        createImageViews();
-        Log("create image views");
-        createRenderPass();
-        Log("render pass created");
-        createGraphicPipeline();
-        Log("create graphic pipeline");
-        createFramebuffer();
-        Log("create framebuffer");
-        createVertexBuffer();
-        Log("create vertex buffer");
-        createIndexBuffer();
-        Log("create index buffer");
-        createCommandBuffer();
-        Log("create command buffers");
-        prepDraw();
-        Log("prepared command buffer to draw");
-        createSemaphores();
-        Log("create semahpores ok");
+        queryWindow();
+
+        InitGraph graph;
+        auto physical_device = graph.Add("physical device", {}, [this]() {
+            pickupPhysicalDevice();
+        });
+        auto queries = graph.Add("device queries", {physical_device}, [this]() {
+            cacheDeviceQueries();
+        });
+        auto device = graph.Add("logic device", {queries}, [this]() {
+            createLogicDevice();
+        });
+        auto shaders = graph.Add("load shaders", {device}, [this]() {
+            loadShaders();
+        });
+        auto allocator = graph.Add("memory allocator", {device}, [this]() {
+            allocator_.Init(physical_device_, device_);
+        });
+        graph.Add("command pool", {device}, [this]() {
+            createCommandPool();
+        });
+        auto swapchain = graph.Add(headless_ ? "offscreen target" : "swapchain", {device}, [this]() {
+            if (headless_) {
+                createOffscreenTarget();
+            } else {
+                createSwapchain();
+            }
+        });
+        graph.Add("frame pacer", {queries}, [this]() {
+            setupFramePacer();
+        });
+        auto image_views = graph.Add("image views", {swapchain}, [this]() {
+            createImageViews();
+        });
+        auto renderpass = graph.Add("render pass", {swapchain}, [this]() {
+            createRenderPass();
+        });
+        auto pipeline_cache = graph.Add("pipeline cache", {device}, [this]() {
+            pipeline_cache_.Init(physical_device_, device_);
+        });
+        auto descriptors = graph.Add("descriptors", {device}, [this]() {
+            descriptor_layouts_.Init(device_);
+            descriptor_allocator_.Init(device_, MaxFramesInFlight);
+            object_layout_ = descriptor_layouts_.Get({
+                {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr}
+            });
+            if (bindless_supported_) {
+                bindless_.Init(device_, bindless_sizes_);
+            }
+        });
+        graph.Add("graphic pipeline", {shaders, renderpass, pipeline_cache, descriptors}, [this]() {
+            createGraphicPipeline();
+        });
+        graph.Add("framebuffer", {image_views, renderpass}, [this]() {
+            createFramebuffer();
+        });
+        auto staging_ring = graph.Add("staging ring", {allocator}, [this]() {
+            createStagingRing();
+        });
+        auto upload_queue = graph.Add("upload queue", {staging_ring}, [this]() {
+            createUploadQueue();
+        });
+        auto buffers = graph.Add("upload buffers", {upload_queue}, [this]() {
+            createVertexBuffer();
+            createIndexBuffer();
+            // send vertices and indices to GPU together, draws on the same queue will see them
+            upload_queue_.Flush();
+        });
+        auto instance_buffers = graph.Add("instance buffers", {buffers}, [this]() {
+            createInstanceBuffers();
+        });
+        auto indirect_buffers = graph.Add("indirect buffers", {instance_buffers}, [this]() {
+            createIndirectBuffers();
+        });
+        graph.Add("frustum culler", {shaders, pipeline_cache, indirect_buffers, descriptors}, [this]() {
+            createFrustumCuller();
+        });
+        graph.Add("object uniforms", {indirect_buffers, descriptors}, [this]() {
+            createObjectUniforms();
+        });
+        graph.Add("bindless buffers", {instance_buffers, descriptors}, [this]() {
+            if (bindless_supported_) {
+                for (int i = 0; i < MaxFramesInFlight; i++) {
+                    bindless_instance_idx_.push_back(bindless_.AddBuffer(instance_buffers_.at(i)));
+                }
+            }
+        });
+        graph.Add("particle system", {shaders, pipeline_cache}, [this]() {
+            createParticleSystem();
+        });
+        graph.Add("frame command pools", {device}, [this]() {
+            frame_pool_.Init(device_, queue_family_idx_.graphic_queue_idx.value(), MaxFramesInFlight, jobs_.ThreadCount() + 1);
+        });
+        graph.Add("gpu profiler", {device}, [this]() {
+            gpu_profiler_.Init(physical_device_, device_, queue_family_idx_.graphic_queue_idx.value(), MaxFramesInFlight);
+        });
+        graph.Add("sync objects", {swapchain}, [this]() {
+            createSyncObjects();
+        });
+
+        graph.Run(jobs_);
+        graph.Report();
+        AddDraw(RectIndices.size());
+    }
+
+    // modules are created while the render pass and pipeline cache are created
+    void loadShaders() {
+        PROFILE_FUNCTION();
+        shader_loader_.Init(device_);
+#ifdef EMBEDDED_SHADERS
+        vert_module_ = shader_loader_.LoadEmbedded("embedded instanced vert", EmbeddedInstancedVertSpv, sizeof(EmbeddedInstancedVertSpv));
+        frag_module_ = shader_loader_.LoadEmbedded("embedded frag", EmbeddedFragSpv, sizeof(EmbeddedFragSpv));
+        object_vert_module_ = shader_loader_.LoadEmbedded("embedded object vert", EmbeddedObjectVertSpv, sizeof(EmbeddedObjectVertSpv));
+        object_push_vert_module_ = shader_loader_.LoadEmbedded("embedded push vert", EmbeddedPushVertSpv, sizeof(EmbeddedPushVertSpv));
+        bindless_vert_module_ = shader_loader_.LoadEmbedded("embedded bindless vert", EmbeddedBindlessVertSpv, sizeof(EmbeddedBindlessVertSpv));
+        cull_module_ = shader_loader_.LoadEmbedded("embedded cull comp", EmbeddedCullCompSpv, sizeof(EmbeddedCullCompSpv));
+        particle_comp_module_ = shader_loader_.LoadEmbedded("embedded particle comp", EmbeddedParticleCompSpv, sizeof(EmbeddedParticleCompSpv));
+        particle_vert_module_ = shader_loader_.LoadEmbedded("embedded particle vert", EmbeddedParticleVertSpv, sizeof(EmbeddedParticleVertSpv));
+#else
+        vert_module_ = shader_loader_.Load("shader/instanced_vert.spv");
+        frag_module_ = shader_loader_.Load("shader/frag.spv");
+        object_vert_module_ = shader_loader_.Load("shader/object_vert.spv");
+        object_push_vert_module_ = shader_loader_.Load("shader/push_vert.spv");
+        bindless_vert_module_ = shader_loader_.Load("shader/bindless_vert.spv");
+        cull_module_ = shader_loader_.Load("shader/cull_comp.spv");
+        particle_comp_module_ = shader_loader_.Load("shader/particle_comp.spv");
+        particle_vert_module_ = shader_loader_.Load("shader/particle_vert.spv");
+#endif
     }
 
     void createInstance() {
+        PROFILE_FUNCTION();
         VkApplicationInfo app_info = {};
         app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
         app_info.pEngineName = "Vulkan Example";
@@ -220,20 +930,23 @@ class App {
         app_info.pApplicationName = "SDL";
         app_info.pNext = nullptr;
 
-        // get SDL extensions
-        uint32_t extension_count;
-        SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, nullptr);
-        assertm("can't get extension from vulkan", extension_count != 0);
-        vector<const char*> extensions(extension_count);
-        SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, extensions.data());
+        // get SDL extensions, headless mode has no surface so don't need them
+        vector<const char*> extensions;
+        if (!headless_) {
+            uint32_t extension_count;
+            SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, nullptr);
+            assertm("can't get extension from vulkan", extension_count != 0);
+            extensions.resize(extension_count);
+            SDL_Vulkan_GetInstanceExtensions(window_, &extension_count, extensions.data());
+        }
 
         // On MacOS, the validation layer rely on this extension, so we add it here.
         // NOTIC: if you don't have this extension, validation layer will not show error untill you create logic device.
         extensions.push_back("VK_KHR_get_physical_device_properties2");
 
-        cout << "SDL provide extensions:" << endl;
+        LogDebug("SDL provide extensions:");
         for (const char* extension: extensions) {
-            cout<< "\t" << extension << endl;
+            LogDebug("\t%s", extension);
         }
 
         VkInstanceCreateInfo instance_create_info = {};
@@ -289,9 +1002,9 @@ class App {
         vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
         vector<VkExtensionProperties> properties(count);
         vkEnumerateInstanceExtensionProperties(nullptr, &count, properties.data());
-        cout << "all supported extensions:" << endl;
+        LogDebug("all supported extensions:");
         for (auto& property: properties) {
-            cout << "\t" << property.extensionName << endl;
+            LogDebug("\t%s", property.extensionName);
         }
     }
 
@@ -301,13 +1014,14 @@ class App {
         vector<VkLayerProperties> properties(count);
         vkEnumerateInstanceLayerProperties(&count, properties.data());
 
-        cout << "all supported validation layers:" << endl;
+        LogDebug("all supported validation layers:");
         for (auto& property: properties) {
-            cout << "\t" << property.layerName << endl;
+            LogDebug("\t%s", property.layerName);
         }
     }
 
     void pickupPhysicalDevice() {
+        PROFILE_FUNCTION();
         uint32_t count;
         vkEnumeratePhysicalDevices(instance_, &count, nullptr);
         assertm("you don't have any GPU support Vulkan", count != 0);
@@ -321,63 +1035,208 @@ class App {
     void printPhysicalDeviceInfo(VkPhysicalDevice& device) {
         VkPhysicalDeviceProperties property;
         vkGetPhysicalDeviceProperties(physical_device_, &property);
-        cout << "physic device property:" << endl;
-        cout << "\tname: " << property.deviceName << endl;
-        cout << "\tintergrated?: " << (property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU?"YES":"NO") << endl;
-        printf("\tapi version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.apiVersion),
-                VK_VERSION_MINOR(property.apiVersion),
-                VK_VERSION_PATCH(property.apiVersion)
-                );
-        printf("\tdriver version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.driverVersion),
-                VK_VERSION_MINOR(property.driverVersion),
-                VK_VERSION_PATCH(property.driverVersion)
-                );
+        Log("physic device property:");
+        Log("\tname: %s", property.deviceName);
+        Log("\tintergrated?: %s", property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ? "YES" : "NO");
+        Log("\tapi version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.apiVersion),
+            VK_VERSION_MINOR(property.apiVersion),
+            VK_VERSION_PATCH(property.apiVersion));
+        Log("\tdriver version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.driverVersion),
+            VK_VERSION_MINOR(property.driverVersion),
+            VK_VERSION_PATCH(property.driverVersion));
     }
 
     void createSurface() {
+        PROFILE_FUNCTION();
+        if (headless_) {
+            surface_ = VK_NULL_HANDLE;
+            return;
+        }
         bool result = SDL_Vulkan_CreateSurface(window_, instance_, &surface_);
         assertm("create surface failed", result == true);
     }
 
+    // must be called on main thread, SDL window functions are not thread safe
+    void queryWindow() {
+        if (headless_) {
+            return;
+        }
+        int w, h;
+        SDL_Vulkan_GetDrawableSize(window_, &w, &h);
+        drawable_size_ = {static_cast<uint32_t>(w), static_cast<uint32_t>(h)};
+        SDL_DisplayMode mode;
+        if (SDL_GetWindowDisplayMode(window_, &mode) == 0 && mode.refresh_rate > 0) {
+            refresh_rate_ = mode.refresh_rate;
+        }
+    }
+
     void createLogicDevice() {
+        PROFILE_FUNCTION();
         VkDeviceCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        create_info.pEnabledFeatures = 0;
         create_info.ppEnabledLayerNames = nullptr;
 
+        // indirect draws need these to draw many commands in one call, and to use first_instance of DrawItem
+        enabled_features_.multiDrawIndirect = supported_features_.multiDrawIndirect;
+        enabled_features_.drawIndirectFirstInstance = supported_features_.drawIndirectFirstInstance;
+
+        // bindless table needs descriptor indexing, otherwise objects are drawn with classic descriptor sets
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+        indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        bindless_supported_ = queryDescriptorIndexing(indexing_features);
+        if (bindless_supported_) {
+            enabled_features_.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+            enabled_features_.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+            // enable only what BindlessTable uses
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported = indexing_features;
+            indexing_features = {};
+            indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+            indexing_features.descriptorBindingStorageBufferUpdateAfterBind = supported.descriptorBindingStorageBufferUpdateAfterBind;
+            indexing_features.descriptorBindingSampledImageUpdateAfterBind = supported.descriptorBindingSampledImageUpdateAfterBind;
+            indexing_features.descriptorBindingUpdateUnusedWhilePending = supported.descriptorBindingUpdateUnusedWhilePending;
+            indexing_features.descriptorBindingPartiallyBound = supported.descriptorBindingPartiallyBound;
+            create_info.pNext = &indexing_features;
+        }
+        create_info.pEnabledFeatures = &enabled_features_;
+
         vector<const char*> extensions;
-        extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        if (!headless_) {
+            extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        }
         // On MacOS, the validation layer rely on this device extension, so we must add it.
-        if (EnableValidation) {
+        // other platforms(like lavapipe on Linux) don't have it
+        if (EnableValidation && checkDeviceExtensionSupport("VK_KHR_portability_subset")) {
             extensions.push_back("VK_KHR_portability_subset");
-            create_info.enabledExtensionCount = extensions.size();
-            create_info.ppEnabledExtensionNames = extensions.data();
         }
+        // let GPU read the draw count of indirect draws from a buffer too
+        bool draw_indirect_count = checkDeviceExtensionSupport(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        if (draw_indirect_count) {
+            extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        }
+        if (bindless_supported_) {
+            extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+            extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        }
+        create_info.enabledExtensionCount = extensions.size();
+        create_info.ppEnabledExtensionNames = extensions.data();
 
-        auto family_idx = getQueueFamilyIdx();
+        auto family_idx = queue_family_idx_;
         assertm("can't find appropriate queue familise", family_idx.Valid());
 
         float priority = 1.0f;
 
-        // we find graphic queue idx and present queue idx, but they are the same index, so we can only create one queue.
-        // if your graphic queue idx and present queue idx are not same, please create queue for each idx.
-        VkDeviceQueueCreateInfo queue_create_info = {};
-        queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        queue_create_info.queueFamilyIndex = family_idx.graphic_queue_idx.value();
-        queue_create_info.queueCount = 1;
-        queue_create_info.pQueuePriorities = &priority;
+        // create one queue for each different family, the same family can't appear twice in VkDeviceCreateInfo
+        std::set<uint32_t> unique_families = {
+            family_idx.graphic_queue_idx.value(),
+            family_idx.present_queue_idx.value(),
+            family_idx.transfer_queue_idx.value(),
+            family_idx.compute_queue_idx.value(),
+        };
+        vector<VkDeviceQueueCreateInfo> queue_create_infos;
+        for (uint32_t family: unique_families) {
+            VkDeviceQueueCreateInfo queue_create_info = {};
+            queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queue_create_info.queueFamilyIndex = family;
+            queue_create_info.queueCount = 1;
+            queue_create_info.pQueuePriorities = &priority;
+            queue_create_infos.push_back(queue_create_info);
+        }
 
-        create_info.queueCreateInfoCount = 1;
-        create_info.pQueueCreateInfos = &queue_create_info;
+        create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
+        create_info.pQueueCreateInfos = queue_create_infos.data();
 
         assertm("can't create logic device", vkCreateDevice(physical_device_, &create_info, nullptr, &device_) == VK_SUCCESS);
         vkGetDeviceQueue(device_, family_idx.graphic_queue_idx.value(), 0, &graphic_queue_);
         vkGetDeviceQueue(device_, family_idx.present_queue_idx.value(), 0, &present_queue_);
+        vkGetDeviceQueue(device_, family_idx.transfer_queue_idx.value(), 0, &transfer_queue_);
+        vkGetDeviceQueue(device_, family_idx.compute_queue_idx.value(), 0, &compute_queue_);
+
+        // it is an extension of Vulkan 1.0, the loader don't export it, so get it from the device
+        if (draw_indirect_count) {
+            cmd_draw_indexed_indirect_count_ = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+                vkGetDeviceProcAddr(device_, "vkCmdDrawIndexedIndirectCountKHR"));
+        }
+        Log("indirect draws: multi draw %s, first instance %s, draw count %s",
+            enabled_features_.multiDrawIndirect ? "YES" : "NO",
+            enabled_features_.drawIndirectFirstInstance ? "YES" : "NO",
+            cmd_draw_indexed_indirect_count_ ? "YES" : "NO");
+        Log("bindless: %s", bindless_supported_ ? "YES" : "NO, classic descriptor sets");
+
+        Log("queue families: graphic = %u, present = %u, transfer = %u%s, compute = %u%s",
+            family_idx.graphic_queue_idx.value(),
+            family_idx.present_queue_idx.value(),
+            family_idx.transfer_queue_idx.value(),
+            family_idx.transfer_queue_idx != family_idx.graphic_queue_idx ? "(dedicated)" : "",
+            family_idx.compute_queue_idx.value(),
+            family_idx.compute_queue_idx != family_idx.graphic_queue_idx ? "(async)" : "");
+    }
+
+    // Vulkan 1.0 reads extension features and limits with vkGetPhysicalDeviceFeatures2KHR/vkGetPhysicalDeviceProperties2KHR
+    // from VK_KHR_get_physical_device_properties2, which createInstance() enabled
+    bool queryDescriptorIndexing(VkPhysicalDeviceDescriptorIndexingFeaturesEXT& indexing_features) {
+        if (!checkDeviceExtensionSupport(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) ||
+            !checkDeviceExtensionSupport(VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
+            return false;
+        }
+        auto get_features2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+            vkGetInstanceProcAddr(instance_, "vkGetPhysicalDeviceFeatures2KHR"));
+        auto get_properties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+            vkGetInstanceProcAddr(instance_, "vkGetPhysicalDeviceProperties2KHR"));
+        if (!get_features2 || !get_properties2) {
+            return false;
+        }
+        VkPhysicalDeviceFeatures2KHR features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+        features2.pNext = &indexing_features;
+        get_features2(physical_device_, &features2);
+        if (!BindlessTable::Supported(supported_features_, indexing_features)) {
+            return false;
+        }
+
+        VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexing_properties = {};
+        indexing_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+        VkPhysicalDeviceProperties2KHR properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+        properties2.pNext = &indexing_properties;
+        get_properties2(physical_device_, &properties2);
+        // every frame's instance buffer must fit, and a pool size can't be 0
+        bindless_sizes_ = BindlessTable::Clamp(indexing_properties);
+        if (bindless_sizes_.buffers < MaxFramesInFlight || bindless_sizes_.images == 0) {
+            Log("bindless limits too low: %u buffers, %u images", bindless_sizes_.buffers, bindless_sizes_.images);
+            return false;
+        }
+        return true;
     }
 
-    QueueFamilyIdx getQueueFamilyIdx() {
+    bool checkDeviceExtensionSupport(const char* name) {
+        uint32_t count;
+        vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &count, nullptr);
+        vector<VkExtensionProperties> properties(count);
+        vkEnumerateDeviceExtensionProperties(physical_device_, nullptr, &count, properties.data());
+        for (auto& property: properties) {
+            if (strcmp(name, property.extensionName) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // query everything which only depends on physical device and surface, the rest of init reads the members
+    void cacheDeviceQueries() {
+        PROFILE_FUNCTION();
+        queue_family_idx_ = queryQueueFamilyIdx();
+        vkGetPhysicalDeviceMemoryProperties(physical_device_, &mem_properties_);
+        vkGetPhysicalDeviceFeatures(physical_device_, &supported_features_);
+        vkGetPhysicalDeviceProperties(physical_device_, &device_properties_);
+        if (!headless_) {
+            surface_format_ = querySurfaceFormat();
+            present_mode_ = querySurfacePresent();
+        }
+    }
+
+    QueueFamilyIdx queryQueueFamilyIdx() {
         uint32_t count;
         vkGetPhysicalDeviceQueueFamilyProperties(physical_device_, &count, nullptr);
         vector<VkQueueFamilyProperties> properties(count);
@@ -387,39 +1246,64 @@ class App {
         for (int i = 0; i < properties.size(); i++) {
             if (properties.at(i).queueFlags&VK_QUEUE_GRAPHICS_BIT) {
                 family_idx.graphic_queue_idx = i;
-                VkBool32 is_present = false;
-                vkGetPhysicalDeviceSurfaceSupportKHR(physical_device_, i, surface_, &is_present);
+                // nothing is presented in headless mode, any graphic queue is ok
+                VkBool32 is_present = headless_;
+                if (!headless_) {
+                    vkGetPhysicalDeviceSurfaceSupportKHR(physical_device_, i, surface_, &is_present);
+                }
                 if (is_present) {
                     family_idx.present_queue_idx = i;
                     break;
                 }
             }
         }
+
+        // a family with transfer but no graphic/compute is usually the DMA engine,
+        // a family with compute but no graphic can run compute shaders while graphic queue is drawing
+        for (int i = 0; i < properties.size(); i++) {
+            VkQueueFlags flags = properties.at(i).queueFlags;
+            if ((flags&VK_QUEUE_TRANSFER_BIT) && !(flags&(VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_COMPUTE_BIT)) &&
+                !family_idx.transfer_queue_idx.has_value()) {
+                family_idx.transfer_queue_idx = i;
+            }
+            if ((flags&VK_QUEUE_COMPUTE_BIT) && !(flags&VK_QUEUE_GRAPHICS_BIT) &&
+                !family_idx.compute_queue_idx.has_value()) {
+                family_idx.compute_queue_idx = i;
+            }
+        }
+        if (!family_idx.transfer_queue_idx.has_value()) {
+            family_idx.transfer_queue_idx = family_idx.graphic_queue_idx;
+        }
+        if (!family_idx.compute_queue_idx.has_value()) {
+            family_idx.compute_queue_idx = family_idx.graphic_queue_idx;
+        }
         return family_idx;
     }
 
     void createCommandPool() {
+        PROFILE_FUNCTION();
         VkCommandPoolCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        create_info.queueFamilyIndex = getQueueFamilyIdx().graphic_queue_idx.value();
+        create_info.queueFamilyIndex = queue_family_idx_.graphic_queue_idx.value();
         assertm("create command pool failed", vkCreateCommandPool(device_, &create_info, nullptr, &commandpool_) == VK_SUCCESS);
     }
 
     void createSwapchain() {
+        PROFILE_FUNCTION();
         VkSwapchainCreateInfoKHR create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 
         create_info.surface = surface_;
 
-        auto format = getSurfaceFormat();
+        auto format = surface_format_;
         create_info.imageColorSpace = format.colorSpace;
         create_info.imageFormat = format.format;
 
         if (format.format == VK_FORMAT_B8G8R8A8_SRGB) {
-            cout << "surface format: BGRA8888 SRGB" << endl;
+            Log("surface format: BGRA8888 SRGB");
         }
         if (format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-            cout << "surface color space: SRGB" << endl;
+            Log("surface color space: SRGB");
         }
 
         auto capabilities = getSurfaceCapabilities();
@@ -427,20 +1311,20 @@ class App {
         if (image_count < capabilities.minImageCount || image_count > capabilities.maxImageCount) {
             image_count = capabilities.minImageCount;
         }
-        cout << "image_count = " << image_count << endl;
+        Log("image_count = %u", image_count);
         create_info.minImageCount = image_count;
 
-        VkExtent2D extent = {WindowWidth, WindowHeight};
-        if (extent.width <= capabilities.minImageExtent.width || extent.width >= capabilities.maxImageExtent.width) {
-            extent.width = capabilities.maxImageExtent.width;
-        }
-        if (extent.height <= capabilities.minImageExtent.height || extent.height >= capabilities.maxImageExtent.height) {
-            extent.height = capabilities.maxImageExtent.height;
+        // currentExtent is the window size, if it is 0xFFFFFFFF the surface size is decided by swapchain
+        VkExtent2D extent = capabilities.currentExtent;
+        if (extent.width == std::numeric_limits<uint32_t>::max()) {
+            extent.width = std::clamp(drawable_size_.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+            extent.height = std::clamp(drawable_size_.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
         }
         create_info.imageExtent = extent;
-        printf("extent = (%d, %d)\n", extent.width, extent.height);
+        swapchain_extent_ = extent;
+        Log("extent = (%u, %u)", extent.width, extent.height);
 
-        auto family_idx = getQueueFamilyIdx();
+        auto family_idx = queue_family_idx_;
         uint32_t idices[] = {family_idx.graphic_queue_idx.value(), family_idx.present_queue_idx.value()};
         if (family_idx.graphic_queue_idx.value() != family_idx.present_queue_idx.value()) {
             create_info.pQueueFamilyIndices = idices;
@@ -453,12 +1337,13 @@ class App {
         }
 
         create_info.imageArrayLayers = 1;   // currently we only draw a 2D triangle, so set it 1
-        create_info.presentMode = getSurfacePresent();
+        create_info.presentMode = present_mode_;
         create_info.preTransform = capabilities.currentTransform;
         create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         create_info.clipped = VK_TRUE;
         create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-        create_info.oldSwapchain = nullptr;
+        // when recreating, the old swapchain let driver reuse its resources and finish presenting old images
+        create_info.oldSwapchain = swapchain_;
         create_info.pNext = nullptr;
 
         assertm("can't create swapchain", vkCreateSwapchainKHR(device_, &create_info, nullptr, &swapchain_) == VK_SUCCESS);
@@ -468,10 +1353,46 @@ class App {
         images_.resize(count);
         vkGetSwapchainImagesKHR(device_, swapchain_, &count, images_.data());
 
-        printf("got %d images\n", count);
+        Log("got %u images", count);
     }
 
-    VkSurfaceFormatKHR getSurfaceFormat() {
+    // render into one offscreen image instead of swapchain images
+    void createOffscreenTarget() {
+        PROFILE_FUNCTION();
+        offscreen_.Init(physical_device_, device_, VK_FORMAT_B8G8R8A8_SRGB, {WindowWidth, WindowHeight});
+        images_ = {offscreen_.Image()};
+        swapchain_extent_ = offscreen_.Extent();
+        Log("offscreen extent = (%u, %u)", swapchain_extent_.width, swapchain_extent_.height);
+    }
+
+    // let the present mode decide how to pace frames, see frame_pacer.hpp
+    void setupFramePacer() {
+        PROFILE_FUNCTION();
+        // nothing to show, run as fast as possible to measure throughput
+        if (headless_) {
+            pacer_.SetMode(PaceMode::Uncapped);
+            return;
+        }
+
+        switch (present_mode_) {
+            case VK_PRESENT_MODE_MAILBOX_KHR:
+                pacer_.SetPresentMode(PresentPacing::Mailbox, refresh_rate_);
+                break;
+            case VK_PRESENT_MODE_IMMEDIATE_KHR:
+                pacer_.SetPresentMode(PresentPacing::Immediate, refresh_rate_);
+                break;
+            default:
+                pacer_.SetPresentMode(PresentPacing::Fifo, refresh_rate_);
+                break;
+        }
+    }
+
+    // format of the images we render into
+    VkFormat getColorFormat() {
+        return headless_ ? offscreen_.Format() : surface_format_.format;
+    }
+
+    VkSurfaceFormatKHR querySurfaceFormat() {
         uint32_t count;
         vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device_, surface_, &count, nullptr);
         vector<VkSurfaceFormatKHR> formats(count);
@@ -485,7 +1406,7 @@ class App {
         return formats.at(0);
     }
 
-    VkPresentModeKHR getSurfacePresent() {
+    VkPresentModeKHR querySurfacePresent() {
         uint32_t count;
         vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device_, surface_, &count, nullptr);
         vector<VkPresentModeKHR> presents(count);
@@ -505,12 +1426,13 @@ class App {
     }
 
     void createImageViews() {
+        PROFILE_FUNCTION();
         imageviews_.resize(images_.size());
         for (int i = 0; i < images_.size(); i++) {
             VkImageViewCreateInfo create_info = {};
             create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
             create_info.image = images_.at(i);
-            create_info.format = getSurfaceFormat().format;
+            create_info.format = getColorFormat();
             create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
             create_info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
             create_info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -525,32 +1447,27 @@ class App {
         }
     }
 
-    VkShaderModule createShaderModule(string filename) {
-        VkShaderModuleCreateInfo create_info = {};
-        create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        string content = ReadShader(filename);
-        create_info.codeSize = content.size();
-        create_info.pCode = (const uint32_t*)(content.data());
-
-        VkShaderModule shader;
-        assertm("can't create shader", vkCreateShaderModule(device_, &create_info, nullptr, &shader) == VK_SUCCESS);
-        return shader;
-    }
-
     void createGraphicPipeline() {
+        PROFILE_FUNCTION();
         VkGraphicsPipelineCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 
-        // vertex input state
-        auto bind_description = Vertex::GetBindingDescriptions();
-        auto attrib_description = Vertex::GetAttribDescriptions();
+        // vertex input state, binding 0 is per vertex and binding 1 is per instance
+        VkVertexInputBindingDescription bind_descriptions[] = {
+            Vertex::GetBindingDescriptions(),
+            InstanceData::GetBindingDescriptions()
+        };
+        auto vertex_attribs = Vertex::GetAttribDescriptions();
+        auto instance_attribs = InstanceData::GetAttribDescriptions();
+        vector<VkVertexInputAttributeDescription> attrib_description(vertex_attribs.begin(), vertex_attribs.end());
+        attrib_description.insert(attrib_description.end(), instance_attribs.begin(), instance_attribs.end());
 
         VkPipelineVertexInputStateCreateInfo vertex_create_info = {};
         vertex_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
         vertex_create_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(attrib_description.size());
         vertex_create_info.pVertexAttributeDescriptions = attrib_description.data();
-        vertex_create_info.vertexBindingDescriptionCount = 1;
-        vertex_create_info.pVertexBindingDescriptions = &bind_description;
+        vertex_create_info.vertexBindingDescriptionCount = 2;
+        vertex_create_info.pVertexBindingDescriptions = bind_descriptions;
 
         create_info.pVertexInputState = &vertex_create_info;
 
@@ -562,44 +1479,28 @@ class App {
 
         create_info.pInputAssemblyState = &assembly_create_info;
 
-        // viewport and scissors
-        VkViewport viewport;
-        viewport.x = 0;
-        viewport.y = 0;
-        int w, h;
-        SDL_Vulkan_GetDrawableSize(window_, &w, &h);
-        viewport.width = w;
-        viewport.height = h;
-        viewport.maxDepth = 1;
-        viewport.minDepth = 0;
-
-        VkRect2D rect;
-        rect.offset = {0, 0};
-        rect.extent.width = w;
-        rect.extent.height = h;
-
+        // viewport and scissors are dynamic states, set them when recording command buffers,
+        // so resizing window don't need a new pipeline
         VkPipelineViewportStateCreateInfo viewport_create_info = {};
         viewport_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewport_create_info.scissorCount = 1;
-        viewport_create_info.pScissors = &rect;
-        viewport_create_info.pViewports = &viewport;
+        viewport_create_info.pScissors = nullptr;
+        viewport_create_info.pViewports = nullptr;
         viewport_create_info.viewportCount = 1;
 
         create_info.pViewportState = &viewport_create_info;
 
         // shaders
-        VkShaderModule vert_module = createShaderModule("shader/vert.spv"),
-                       frag_module = createShaderModule("shader/frag.spv");
-
+        // modules are owned by shader_loader_, other pipelines using the same files get the same modules
         VkPipelineShaderStageCreateInfo vert_create_info = {};
         vert_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vert_create_info.module = vert_module;
+        vert_create_info.module = vert_module_;
         vert_create_info.pName = "main";
         vert_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
 
         VkPipelineShaderStageCreateInfo frag_create_info = {};
         frag_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        frag_create_info.module = frag_module;
+        frag_create_info.module = frag_module_;
         frag_create_info.pName = "main";
         frag_create_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 
@@ -654,8 +1555,19 @@ class App {
         create_info.pColorBlendState = &color_create_info;
 
         // pipeline layout
+        // set 0 is the object uniforms, and the same data can come from push constants too.
+        // pipelines which don't use them are still compatible with this layout
+        VkPushConstantRange push_range = {};
+        push_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        push_range.offset = 0;
+        push_range.size = sizeof(ObjectUniform);
+
         VkPipelineLayoutCreateInfo layout_create_info = {};
         layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layout_create_info.setLayoutCount = 1;
+        layout_create_info.pSetLayouts = &object_layout_;
+        layout_create_info.pushConstantRangeCount = 1;
+        layout_create_info.pPushConstantRanges = &push_range;
 
         assertm("pipeline layout can't create", vkCreatePipelineLayout(device_, &layout_create_info, nullptr, &pipeline_layout_) == VK_SUCCESS);
 
@@ -665,30 +1577,82 @@ class App {
         create_info.renderPass = renderpass_;
 
         // dynamic state
-        create_info.pDynamicState = nullptr;
-
-        // create pipeline
-        assertm("pipeline can't create", vkCreateGraphicsPipelines(device_, nullptr, 1, &create_info, nullptr, &pipeline_) == VK_SUCCESS);
+        VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamic_create_info = {};
+        dynamic_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamic_create_info.dynamicStateCount = 2;
+        dynamic_create_info.pDynamicStates = dynamic_states;
+
+        create_info.pDynamicState = &dynamic_create_info;
+
+        // create pipeline, with a warm cache the driver can skip compiling shaders
+        auto begin = std::chrono::steady_clock::now();
+        assertm("pipeline can't create", vkCreateGraphicsPipelines(device_, pipeline_cache_.Get(), 1, &create_info, nullptr, &pipeline_) == VK_SUCCESS);
+        Log("graphic pipeline created in %.3fms(%s start)",
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count(),
+            pipeline_cache_.Loaded() ? "warm" : "cold");
+
+        // object pipeline only has per vertex input, the rest comes from uniforms
+        vertex_create_info.vertexAttributeDescriptionCount = vertex_attribs.size();
+        vertex_create_info.pVertexAttributeDescriptions = vertex_attribs.data();
+        vertex_create_info.vertexBindingDescriptionCount = 1;
+        stage_create_infos[0].module = object_vert_module_;
+        assertm("object pipeline can't create", vkCreateGraphicsPipelines(device_, pipeline_cache_.Get(), 1, &create_info, nullptr, &object_pipeline_) == VK_SUCCESS);
+        stage_create_infos[0].module = object_push_vert_module_;
+        assertm("object push pipeline can't create", vkCreateGraphicsPipelines(device_, pipeline_cache_.Get(), 1, &create_info, nullptr, &object_push_pipeline_) == VK_SUCCESS);
+
+        // bindless pipeline has its own layout: the bindless table as set 0, and two indices as push constants.
+        // the shader's buffer array has the table's size, given as specialization constant
+        if (bindless_supported_) {
+            VkDescriptorSetLayout bindless_layout = bindless_.Layout();
+            push_range.size = sizeof(uint32_t) * 2;
+            layout_create_info.pSetLayouts = &bindless_layout;
+            assertm("bindless pipeline layout can't create", vkCreatePipelineLayout(device_, &layout_create_info, nullptr, &bindless_pipeline_layout_) == VK_SUCCESS);
+
+            uint32_t buffer_count = bindless_sizes_.buffers;
+            VkSpecializationMapEntry map_entry = {BindlessTable::BufferCountConstant, 0, sizeof(buffer_count)};
+            VkSpecializationInfo specialization = {};
+            specialization.mapEntryCount = 1;
+            specialization.pMapEntries = &map_entry;
+            specialization.dataSize = sizeof(buffer_count);
+            specialization.pData = &buffer_count;
+
+            create_info.layout = bindless_pipeline_layout_;
+            stage_create_infos[0].module = bindless_vert_module_;
+            stage_create_infos[0].pSpecializationInfo = &specialization;
+            assertm("bindless pipeline can't create", vkCreateGraphicsPipelines(device_, pipeline_cache_.Get(), 1, &create_info, nullptr, &bindless_pipeline_) == VK_SUCCESS);
+            stage_create_infos[0].pSpecializationInfo = nullptr;
+            create_info.layout = pipeline_layout_;
+        }
 
-        // destroy shaders
-        vkDestroyShaderModule(device_, vert_module, nullptr);
-        vkDestroyShaderModule(device_, frag_module, nullptr);
+        // particle pipeline only differs in vertex input, topology and vertex shader
+        auto particle_binding = Particle::GetBindingDescriptions();
+        auto particle_attribs = Particle::GetAttribDescriptions();
+        vertex_create_info.vertexAttributeDescriptionCount = particle_attribs.size();
+        vertex_create_info.pVertexAttributeDescriptions = particle_attribs.data();
+        vertex_create_info.vertexBindingDescriptionCount = 1;
+        vertex_create_info.pVertexBindingDescriptions = &particle_binding;
+        assembly_create_info.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+        stage_create_infos[0].module = particle_vert_module_;
+        assertm("particle pipeline can't create", vkCreateGraphicsPipelines(device_, pipeline_cache_.Get(), 1, &create_info, nullptr, &particle_pipeline_) == VK_SUCCESS);
     }
 
     void createRenderPass() {
+        PROFILE_FUNCTION();
         VkRenderPassCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
         
         // attachment description
         VkAttachmentDescription description = {};
-        description.format = getSurfaceFormat().format;
+        description.format = getColorFormat();
         description.samples = VK_SAMPLE_COUNT_1_BIT;
         description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
         description.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        description.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        // offscreen image is copied to readback buffer after the render pass
+        description.finalLayout = headless_ ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
         // subpass
         VkAttachmentReference reference = {};
@@ -725,14 +1689,13 @@ class App {
     }
 
     void createFramebuffer() {
-        int w, h;
-        SDL_Vulkan_GetDrawableSize(window_, &w, &h);
+        PROFILE_FUNCTION();
         framebuffers_.resize(images_.size());
         for (int i = 0; i < images_.size(); i++) {
             VkFramebufferCreateInfo create_info = {};
             create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            create_info.width = w;
-            create_info.height = h;
+            create_info.width = swapchain_extent_.width;
+            create_info.height = swapchain_extent_.height;
             create_info.attachmentCount = 1;
             create_info.pAttachments = &imageviews_.at(i);
             create_info.renderPass = renderpass_;
@@ -741,116 +1704,476 @@ class App {
         }
     }
 
-    void createCommandBuffer() {
-        command_buffers_.resize(framebuffers_.size());
+    // command buffers and descriptor sets of the frame are allocated again, GPU must not be using them
+    void resetFrame(uint32_t frame_idx) {
+        frame_pool_.Reset(frame_idx);
+        descriptor_allocator_.Reset(frame_idx);
+    }
 
-        VkCommandBufferAllocateInfo allocate_info = {};
-        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocate_info.commandPool = commandpool_;
-        allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocate_info.commandBufferCount = static_cast<uint32_t>(command_buffers_.size());
+    // record the whole frame again, the buffer comes from a pool which was just reset
+    void recordFrame(VkCommandBuffer buffer, uint32_t frame_idx, uint32_t image_idx) {
+        PROFILE_FUNCTION();
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        assertm("can't begin record command buffer", vkBeginCommandBuffer(buffer, &begin_info) == VK_SUCCESS);
 
-        assertm("command buffers create failed", vkAllocateCommandBuffers(device_, &allocate_info, command_buffers_.data()) == VK_SUCCESS);
-    }
+        // query reset must be outside render pass
+        gpu_profiler_.BeginFrame(frame_idx, buffer);
+
+        // dispatch can't be inside render pass
+        if (culling_) {
+            GpuScope scope(gpu_profiler_, buffer, "cull");
+            culler_.Record(buffer, descriptor_allocator_, frame_idx, instances_.size(), FrustumCuller::Planes(-1, -1, 1, 1));
+        }
+        // async compute submitted the step already, drawFrame() waits for it
+        if (particles_.Enabled() && !particles_.Async()) {
+            GpuScope scope(gpu_profiler_, buffer, "particles");
+            particles_.RecordStep(buffer, ParticleTimeStep);
+        }
 
-    void prepDraw() {
-        for (int i = 0; i < command_buffers_.size(); i++) {
-            VkCommandBuffer& buffer = command_buffers_.at(i);
-            VkCommandBufferBeginInfo begin_info = {};
-            begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-            assertm("can't begin record command buffer", vkBeginCommandBuffer(buffer, &begin_info) == VK_SUCCESS);
+        uint32_t pass_scope = gpu_profiler_.Begin(buffer, "render pass");
 
-            VkRenderPassBeginInfo renderpass_begin_info = {};
-            renderpass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        VkRenderPassBeginInfo renderpass_begin_info = {};
+        renderpass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 
-            VkClearValue clear_value = {0, 0.5, 0, 1};
-            renderpass_begin_info.renderPass = renderpass_;
-            renderpass_begin_info.clearValueCount = 1;
-            renderpass_begin_info.pClearValues = &clear_value;
-            renderpass_begin_info.framebuffer = framebuffers_.at(i);
-            renderpass_begin_info.renderArea.offset = {0, 0};
-            int w, h;
-            SDL_Vulkan_GetDrawableSize(window_, &w, &h);
-            renderpass_begin_info.renderArea.extent.width = w;
-            renderpass_begin_info.renderArea.extent.height = h;
+        VkClearValue clear_value = {0, 0.5, 0, 1};
+        renderpass_begin_info.renderPass = renderpass_;
+        renderpass_begin_info.clearValueCount = 1;
+        renderpass_begin_info.pClearValues = &clear_value;
+        renderpass_begin_info.framebuffer = framebuffers_.at(image_idx);
+        renderpass_begin_info.renderArea.offset = {0, 0};
+        renderpass_begin_info.renderArea.extent = swapchain_extent_;
 
+        // indirect mode records only a few commands, no need to split them to threads
+        if (record_threads_ <= 1 || indirect_) {
             vkCmdBeginRenderPass(buffer, &renderpass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+            recordDraws(buffer, frame_idx, 0, draw_list_.size(), true);
+            recordParticles(buffer);
+        } else {
+            // the render pass can only contain vkCmdExecuteCommands now
+            vector<VkCommandBuffer> secondaries = recordSecondaries(frame_idx, image_idx);
+            vkCmdBeginRenderPass(buffer, &renderpass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            vkCmdExecuteCommands(buffer, secondaries.size(), secondaries.data());
+        }
+
+        vkCmdEndRenderPass(buffer);
+        gpu_profiler_.End(buffer, pass_scope);
+
+        if (headless_) {
+            offscreen_.RecordReadback(buffer);
+        }
+
+        assertm("can't end record command buffer", vkEndCommandBuffer(buffer) == VK_SUCCESS);
+    }
+
+    // split draw list into record_threads_ pieces, record each piece into a secondary buffer on a worker.
+    // returned buffers keep the order of draw list, particles are recorded last on main thread
+    vector<VkCommandBuffer> recordSecondaries(uint32_t frame_idx, uint32_t image_idx) {
+        uint32_t job_count = record_threads_;
+        size_t per_job = (draw_list_.size() + job_count - 1) / job_count;
+        vector<VkCommandBuffer> secondaries(job_count);
+
+        jobs_.ParallelFor(job_count, [&](uint32_t job, uint32_t worker) {
+            PROFILE_ZONE("record secondary");
+            // each worker has its own pool, so no lock is needed
+            VkCommandBuffer secondary = frame_pool_.Get(frame_idx, VK_COMMAND_BUFFER_LEVEL_SECONDARY, worker + 1);
+            beginSecondary(secondary, image_idx);
+
+            size_t begin = std::min(draw_list_.size(), job * per_job);
+            size_t end = std::min(draw_list_.size(), begin + per_job);
+            recordDraws(secondary, frame_idx, begin, end);
+
+            assertm("can't end record secondary command buffer", vkEndCommandBuffer(secondary) == VK_SUCCESS);
+            secondaries.at(job) = secondary;
+        });
+
+        if (particles_.Enabled()) {
+            VkCommandBuffer secondary = frame_pool_.Get(frame_idx, VK_COMMAND_BUFFER_LEVEL_SECONDARY, 0);
+            beginSecondary(secondary, image_idx);
+            recordParticles(secondary);
+            assertm("can't end record secondary command buffer", vkEndCommandBuffer(secondary) == VK_SUCCESS);
+            secondaries.push_back(secondary);
+        }
+        return secondaries;
+    }
+
+    void beginSecondary(VkCommandBuffer secondary, uint32_t image_idx) {
+        VkCommandBufferInheritanceInfo inheritance_info = {};
+        inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance_info.renderPass = renderpass_;
+        inheritance_info.subpass = 0;
+        inheritance_info.framebuffer = framebuffers_.at(image_idx);
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT|VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        begin_info.pInheritanceInfo = &inheritance_info;
+        assertm("can't begin record secondary command buffer", vkBeginCommandBuffer(secondary, &begin_info) == VK_SUCCESS);
+    }
 
-            vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
+    // secondary buffers don't inherit any state, so every buffer binds everything again.
+    // profile_draws puts timestamps around the first draws, only the main thread can do it
+    void recordDraws(VkCommandBuffer buffer, uint32_t frame_idx, size_t begin, size_t end, bool profile_draws = false) {
+        if (objects_) {
+            recordObjectDraws(buffer, frame_idx, begin, end);
+            return;
+        }
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_);
+        setViewportScissor(buffer);
+
+        // bind vertex buffer and this frame's instance buffer, or only the visible instances when culling
+        VkBuffer vertex_buffers[] = {vertex_buffer_, culling_ ? culled_buffers_.at(frame_idx) : instance_buffers_.at(frame_idx)};
+        VkDeviceSize offsets[] = {0, 0};
+        vkCmdBindVertexBuffers(buffer, 0, 2, vertex_buffers, offsets);
+        vkCmdBindIndexBuffer(buffer, index_buffer_, 0, VK_INDEX_TYPE_UINT16);
+
+        if (indirect_) {
+            recordIndirectDraws(buffer, frame_idx);
+            return;
+        }
 
-            // bind vertex buffer
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(buffer, 0, 1, &vertex_buffer_, offsets);
-            vkCmdBindIndexBuffer(buffer, index_buffer_, 0, VK_INDEX_TYPE_UINT16);
+        for (size_t i = begin; i < end; i++) {
+            const DrawItem& draw = draw_list_.at(i);
+            if (profile_draws && i < MaxProfiledDraws) {
+                GpuScope scope(gpu_profiler_, buffer, "draw " + std::to_string(i));
+                vkCmdDrawIndexed(buffer, draw.index_count, draw.instance_count, draw.first_index, draw.vertex_offset, draw.first_instance);
+            } else {
+                vkCmdDrawIndexed(buffer, draw.index_count, draw.instance_count, draw.first_index, draw.vertex_offset, draw.first_instance);
+            }
+        }
+    }
 
-            vkCmdDrawIndexed(buffer, RectIndices.size(), 1, 0, 0, 0);
+    // DynamicUniform: every draw binds the same descriptor set, only the dynamic offset moves to its own ObjectUniform.
+    // PushConstant: every draw pushes its ObjectUniform, nothing is read from memory.
+    // Bindless: the table is bound once, every draw pushes where its instance is
+    void recordObjectDraws(VkCommandBuffer buffer, uint32_t frame_idx, size_t begin, size_t end) {
+        VkPipeline pipeline = object_pipeline_;
+        if (object_path_ == ObjectPath::PushConstant) {
+            pipeline = object_push_pipeline_;
+        } else if (object_path_ == ObjectPath::Bindless) {
+            pipeline = bindless_pipeline_;
+        }
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        setViewportScissor(buffer);
+
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(buffer, 0, 1, &vertex_buffer_, &offset);
+        vkCmdBindIndexBuffer(buffer, index_buffer_, 0, VK_INDEX_TYPE_UINT16);
+
+        if (object_path_ == ObjectPath::Bindless) {
+            VkDescriptorSet table = bindless_.Set();
+            vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, bindless_pipeline_layout_, 0, 1, &table, 0, nullptr);
+            for (size_t i = begin; i < end; i++) {
+                const DrawItem& draw = draw_list_.at(i);
+                uint32_t indices[] = {bindless_instance_idx_.at(frame_idx), draw.first_instance};
+                vkCmdPushConstants(buffer, bindless_pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(indices), indices);
+                vkCmdDrawIndexed(buffer, draw.index_count, 1, draw.first_index, draw.vertex_offset, 0);
+            }
+            return;
+        }
 
-            vkCmdEndRenderPass(buffer);
+        if (object_path_ == ObjectPath::PushConstant) {
+            for (size_t i = begin; i < end; i++) {
+                const DrawItem& draw = draw_list_.at(i);
+                ObjectUniform object = objectUniform(draw);
+                vkCmdPushConstants(buffer, pipeline_layout_, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(object), &object);
+                vkCmdDrawIndexed(buffer, draw.index_count, 1, draw.first_index, draw.vertex_offset, 0);
+            }
+            return;
+        }
 
-            assertm("can't end record command buffer", vkEndCommandBuffer(buffer) == VK_SUCCESS);
+        VkDescriptorSet set = object_uniforms_.Set();
+        uint32_t stride = object_uniforms_.AlignedSize(sizeof(ObjectUniform));
+        end = std::min<size_t>(end, MaxObjects);
+        for (size_t i = begin; i < end; i++) {
+            const DrawItem& draw = draw_list_.at(i);
+            uint32_t dynamic_offset = object_offsets_.at(frame_idx) + i * stride;
+            vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_, 0, 1, &set, 1, &dynamic_offset);
+            vkCmdDrawIndexed(buffer, draw.index_count, 1, draw.first_index, draw.vertex_offset, 0);
         }
     }
 
-    void createSemaphores() {
+    // the particle buffer written by the last step is read as vertex buffer, one point for each particle
+    void recordParticles(VkCommandBuffer buffer) {
+        if (!particles_.Enabled()) {
+            return;
+        }
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particle_pipeline_);
+        setViewportScissor(buffer);
+        VkBuffer particle_buffer = particles_.RenderBuffer();
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(buffer, 0, 1, &particle_buffer, &offset);
+        vkCmdDraw(buffer, particles_.Count(), 1, 0, 0);
+    }
+
+    // pipelines use dynamic viewport and scissor, every command buffer must set them
+    void setViewportScissor(VkCommandBuffer buffer) {
+        VkViewport viewport = {};
+        viewport.x = 0;
+        viewport.y = 0;
+        viewport.width = swapchain_extent_.width;
+        viewport.height = swapchain_extent_.height;
+        viewport.minDepth = 0;
+        viewport.maxDepth = 1;
+        vkCmdSetViewport(buffer, 0, 1, &viewport);
+
+        VkRect2D scissor = {};
+        scissor.offset = {0, 0};
+        scissor.extent = swapchain_extent_;
+        vkCmdSetScissor(buffer, 0, 1, &scissor);
+    }
+
+    // draws come from the frame's indirect buffer which writeIndirectCommands() filled
+    void recordIndirectDraws(VkCommandBuffer buffer, uint32_t frame_idx) {
+        VkBuffer commands = indirect_buffers_.at(frame_idx);
+        uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+        uint32_t draw_count = culling_ ? 1 : std::min<uint32_t>(draw_list_.size(), MaxIndirectDraws);
+        if (cmd_draw_indexed_indirect_count_) {
+            // count is read from the buffer too, so these commands are the same however the draw list changes
+            cmd_draw_indexed_indirect_count_(buffer, commands, IndirectCommandsOffset, commands, 0, MaxIndirectDraws, stride);
+        } else if (enabled_features_.multiDrawIndirect) {
+            vkCmdDrawIndexedIndirect(buffer, commands, IndirectCommandsOffset, draw_count, stride);
+        } else {
+            // without multiDrawIndirect drawCount must be 0 or 1
+            for (uint32_t i = 0; i < draw_count; i++) {
+                vkCmdDrawIndexedIndirect(buffer, commands, IndirectCommandsOffset + i * stride, 1, stride);
+            }
+        }
+    }
+
+    void createSyncObjects() {
+        PROFILE_FUNCTION();
+        image_avaliable_semaphores_.resize(MaxFramesInFlight);
+        present_finish_semaphores_.resize(MaxFramesInFlight);
+        inflight_fences_.resize(MaxFramesInFlight);
+        images_inflight_.resize(images_.size(), VK_NULL_HANDLE);
+
         VkSemaphoreCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        assertm("create image avaliable semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &image_avaliable_semaphore_) == VK_SUCCESS);
-        assertm("create present finish semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &present_finish_semaphore_) == VK_SUCCESS);
-    }
 
-    void createVertexBuffer() {
-        VkDeviceSize size = sizeof(Vertex)*RectVertices.size();
+        // create fences signaled, so the first wait of each frame won't block forever
+        VkFenceCreateInfo fence_create_info = {};
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_buf_memory;
-        createBuffer(size,
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            assertm("create image avaliable semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &image_avaliable_semaphores_.at(i)) == VK_SUCCESS);
+            assertm("create present finish semaphore failed", vkCreateSemaphore(device_, &create_info, nullptr, &present_finish_semaphores_.at(i)) == VK_SUCCESS);
+            assertm("create inflight fence failed", vkCreateFence(device_, &fence_create_info, nullptr, &inflight_fences_.at(i)) == VK_SUCCESS);
+        }
+    }
+
+    // create the staging buffer once, and keep it mapped untill quit
+    void createStagingRing() {
+        PROFILE_FUNCTION();
+        createBuffer(StagingRingSize,
                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                     staging_buffer, staging_buf_memory);
+                     staging_buffer_, staging_memory_, "staging ring");
+        staging_ring_.Init(device_, staging_buffer_, staging_memory_.mapped, StagingRingSize);
+    }
 
-        void* data;
-        vkMapMemory(device_, staging_buf_memory, 0, size, 0, &data);
-        memcpy(data, RectVertices.data(), size);
-        vkUnmapMemory(device_, staging_buf_memory);
+    // copy on the dedicated transfer queue if we have one, so big uploads don't block drawing
+    void createUploadQueue() {
+        PROFILE_FUNCTION();
+        auto family_idx = queue_family_idx_;
+        upload_queue_.Init(device_, transfer_queue_, family_idx.transfer_queue_idx.value(), staging_ring_);
+        upload_queue_.SetConsumerQueue(graphic_queue_, family_idx.graphic_queue_idx.value());
+    }
+
+    void createVertexBuffer() {
+        PROFILE_FUNCTION();
+        VkDeviceSize size = sizeof(Vertex)*RectVertices.size();
 
         createBuffer(size,
                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                     vertex_buffer_, vertex_buf_memory_);
-
-        copyBuffer(staging_buffer, vertex_buffer_, size);
+                     vertex_buffer_, vertex_buf_memory_, "vertex buffer");
 
-        vkDestroyBuffer(device_, staging_buffer, nullptr);
-        vkFreeMemory(device_, staging_buf_memory, nullptr);
+        upload_queue_.Enqueue(vertex_buffer_, 0, RectVertices.data(), size);
     }
 
     void createIndexBuffer() {
+        PROFILE_FUNCTION();
         VkDeviceSize size = sizeof(uint16_t)*RectIndices.size();
-        VkBuffer staging_buffer;
-        VkDeviceMemory staging_memory;
-        createBuffer(size,
-                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                     staging_buffer, staging_memory);
-
-        void* data;
-        vkMapMemory(device_, staging_memory, 0, size, 0, &data);
-        memcpy(data, RectIndices.data(), size);
-        vkUnmapMemory(device_, staging_memory);
 
         createBuffer(size,
                      VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                     index_buffer_, index_buf_memory_);
+                     index_buffer_, index_buf_memory_, "index buffer");
+
+        upload_queue_.Enqueue(index_buffer_, 0, RectIndices.data(), size);
+    }
+
+    // instances change every frame, so GPU reads them from host visible memory directly instead of copying to
+    // device local memory. each frame in flight has its own buffer, CPU never writes what GPU is reading
+    void createInstanceBuffers() {
+        PROFILE_FUNCTION();
+        instance_buffers_.resize(MaxFramesInFlight);
+        instance_memories_.resize(MaxFramesInFlight);
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            createBuffer(sizeof(InstanceData) * MaxInstances,
+                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         instance_buffers_.at(i), instance_memories_.at(i), "instance buffer");
+        }
 
-        copyBuffer(staging_buffer, index_buffer_, size);
+        // only GPU touches the culled instances
+        culled_buffers_.resize(MaxFramesInFlight);
+        culled_memories_.resize(MaxFramesInFlight);
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            createBuffer(sizeof(InstanceData) * MaxInstances,
+                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         culled_buffers_.at(i), culled_memories_.at(i), "culled instance buffer");
+        }
+    }
 
-        vkDestroyBuffer(device_, staging_buffer, nullptr);
-        vkFreeMemory(device_, staging_memory, nullptr);
+    void createIndirectBuffers() {
+        PROFILE_FUNCTION();
+        indirect_buffers_.resize(MaxFramesInFlight);
+        indirect_memories_.resize(MaxFramesInFlight);
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            createBuffer(IndirectCommandsOffset + sizeof(VkDrawIndexedIndirectCommand) * MaxIndirectDraws,
+                         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                         indirect_buffers_.at(i), indirect_memories_.at(i), "indirect buffer");
+        }
+    }
+
+    void createFrustumCuller() {
+        PROFILE_FUNCTION();
+        culler_.Init(device_, cull_module_, pipeline_cache_.Get(), descriptor_layouts_, MaxFramesInFlight);
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            culler_.SetBuffers(i, instance_buffers_.at(i), culled_buffers_.at(i), indirect_buffers_.at(i));
+        }
+    }
+
+    // one region for each frame in flight, big enough for MaxObjects aligned ObjectUniforms
+    void createObjectUniforms() {
+        PROFILE_FUNCTION();
+        VkDeviceSize alignment = device_properties_.limits.minUniformBufferOffsetAlignment;
+        VkDeviceSize frame_size = DynamicUniformBuffer::RequiredSize(sizeof(ObjectUniform), 1, alignment) * MaxObjects;
+        createBuffer(DynamicUniformBuffer::RequiredSize(frame_size, MaxFramesInFlight, alignment),
+                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     object_buffer_, object_memory_, "object uniforms");
+        object_uniforms_.Init(device_, object_buffer_, object_memory_.mapped, frame_size, MaxFramesInFlight,
+                              alignment, object_layout_, sizeof(ObjectUniform));
+        object_offsets_.assign(MaxFramesInFlight, 0);
+    }
+
+    // uniforms of all draws in one piece, draw i is at i * stride. call it after the frame's fence was signaled
+    void writeObjectUniforms(uint32_t frame_idx) {
+        PROFILE_FUNCTION();
+        object_uniforms_.Reset(frame_idx);
+        uint32_t count = std::min<uint32_t>(draw_list_.size(), MaxObjects);
+        VkDeviceSize stride = object_uniforms_.AlignedSize(sizeof(ObjectUniform));
+        UniformSlice slice = object_uniforms_.Allocate(frame_idx, stride * std::max(count, 1u));
+        object_offsets_.at(frame_idx) = slice.offset;
+
+        char* mapped = static_cast<char*>(slice.data);
+        for (uint32_t i = 0; i < count; i++) {
+            ObjectUniform object = objectUniform(draw_list_.at(i));
+            memcpy(mapped + i * stride, &object, sizeof(object));
+        }
+    }
+
+    // model matrix and color of the draw's first instance
+    ObjectUniform objectUniform(const DrawItem& draw) const {
+        ObjectUniform object = {glm::mat4(1.0f), {1, 1, 1, 1}, 0};
+        if (draw.first_instance < instances_.size()) {
+            const InstanceData& data = instances_.at(draw.first_instance);
+            // scale by transform.zw, then move by transform.xy
+            object.model[0][0] = data.transform.z;
+            object.model[1][1] = data.transform.w;
+            object.model[3][0] = data.transform.x;
+            object.model[3][1] = data.transform.y;
+            object.color = {data.color.x, data.color.y, data.color.z, 1};
+        }
+        return object;
+    }
+
+    // buffers are created by EnableParticles(), when the count is known
+    void createParticleSystem() {
+        PROFILE_FUNCTION();
+        auto family_idx = queue_family_idx_;
+        particles_.Init(device_, particle_comp_module_, pipeline_cache_.Get(), compute_queue_,
+                        family_idx.compute_queue_idx.value(), family_idx.graphic_queue_idx.value(), MaxFramesInFlight);
+    }
+
+    void destroyParticleBuffers() {
+        for (size_t i = 0; i < particle_buffers_.size(); i++) {
+            vkDestroyBuffer(device_, particle_buffers_.at(i), nullptr);
+            allocator_.Free(particle_memories_.at(i));
+        }
+        particle_buffers_.clear();
+        particle_memories_.clear();
+    }
+
+    // one command drawing the quad, culler_ counts instanceCount up from 0.
+    // call it after the frame's fence was signaled, it also takes the visible count of the last time
+    void writeCullCommand(uint32_t frame_idx) {
+        PROFILE_FUNCTION();
+        char* mapped = static_cast<char*>(indirect_memories_.at(frame_idx).mapped);
+        auto* command = reinterpret_cast<VkDrawIndexedIndirectCommand*>(mapped + IndirectCommandsOffset);
+        visible_instances_ = command->instanceCount;
+
+        uint32_t draw_count = 1;
+        memcpy(mapped, &draw_count, sizeof(draw_count));
+        command->indexCount = RectIndices.size();
+        command->instanceCount = 0;
+        command->firstIndex = 0;
+        command->vertexOffset = 0;
+        command->firstInstance = 0;
+    }
+
+    void reportCulling() {
+        if (culling_) {
+            Log("culling: %u of %zu instances visible", visible_instances_, instances_.size());
+        }
     }
 
-    void copyBuffer(VkBuffer& src, VkBuffer& dst, VkDeviceSize size) {
+    // write the draw count and one command for each draw item, call it after the frame's fence was signaled
+    void writeIndirectCommands(uint32_t frame_idx) {
+        PROFILE_FUNCTION();
+        char* mapped = static_cast<char*>(indirect_memories_.at(frame_idx).mapped);
+        uint32_t draw_count = std::min<uint32_t>(draw_list_.size(), MaxIndirectDraws);
+        memcpy(mapped, &draw_count, sizeof(draw_count));
+
+        auto* commands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(mapped + IndirectCommandsOffset);
+        for (uint32_t i = 0; i < draw_count; i++) {
+            const DrawItem& draw = draw_list_.at(i);
+            commands[i].indexCount = draw.index_count;
+            commands[i].instanceCount = draw.instance_count;
+            commands[i].firstIndex = draw.first_index;
+            commands[i].vertexOffset = draw.vertex_offset;
+            commands[i].firstInstance = draw.first_instance;
+        }
+    }
+
+    // call it after the frame's fence was signaled
+    void writeInstances(uint32_t frame_idx) {
+        PROFILE_FUNCTION();
+        memcpy(instance_memories_.at(frame_idx).mapped, instances_.data(), sizeof(InstanceData) * instances_.size());
+    }
+
+    // quads of 80% of a cell, colored by their position. the grid covers [-extent, extent] of NDC
+    vector<InstanceData> makeGrid(uint32_t count, float extent = 1.0f) {
+        uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+        float cell = 2.0f * extent / side;
+        vector<InstanceData> instances(count);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t x = i % side, y = i / side;
+            instances.at(i).transform = {-extent + cell * (x + 0.5f), -extent + cell * (y + 0.5f), cell * 0.8f, cell * 0.8f};
+            instances.at(i).color = {float(x) / side, float(y) / side, 1.0f};
+        }
+        return instances;
+    }
+
+    // submit one copy and wait for it, only used to compare with upload queue in BenchmarkUpload()
+    void copyBufferBlocking(const StagingRegion& src, VkBuffer& dst, VkDeviceSize size) {
         VkCommandBufferAllocateInfo allocate_info = {};
         allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
         allocate_info.commandPool = commandpool_;
@@ -867,9 +2190,9 @@ class App {
 
         VkBufferCopy region = {};
         region.size = size;
-        region.srcOffset = 0;
+        region.srcOffset = src.offset;
         region.dstOffset = 0;
-        vkCmdCopyBuffer(buffer, src, dst, 1, &region);
+        vkCmdCopyBuffer(buffer, src.buffer, dst, 1, &region);
 
         vkEndCommandBuffer(buffer);
 
@@ -878,114 +2201,391 @@ class App {
         submit_info.commandBufferCount = 1;
         submit_info.pCommandBuffers = &buffer;
 
-        vkQueueSubmit(graphic_queue_, 1, &submit_info, nullptr);
-        vkQueueWaitIdle(graphic_queue_);
+        // staging ring reuses the region after this fence signaled
+        VkFence fence = staging_ring_.Retire();
+        vkQueueSubmit(graphic_queue_, 1, &submit_info, fence);
+        vkWaitForFences(device_, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
 
         vkFreeCommandBuffers(device_, commandpool_, 1, &buffer);
     }
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory) {
+    // buffer used by more than one queue family lists them in families, it is shared CONCURRENT
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& memory, const char* name = "",
+                      const vector<uint32_t>& families = {}) {
         VkBufferCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         create_info.usage = usage;
         create_info.size = size;
         create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (families.size() > 1) {
+            create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            create_info.queueFamilyIndexCount = families.size();
+            create_info.pQueueFamilyIndices = families.data();
+        }
 
         assertm("create buffer failed", vkCreateBuffer(device_, &create_info, nullptr, &buffer) == VK_SUCCESS);
 
         VkMemoryRequirements requirements = {};
         vkGetBufferMemoryRequirements(device_, buffer, &requirements);
 
-        VkMemoryAllocateInfo allocate_info = {};
-        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocate_info.allocationSize = requirements.size;
-        allocate_info.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+        // take a piece of a big memory block instead of calling vkAllocateMemory for each buffer
+        memory = allocator_.Allocate(requirements, findMemoryType(requirements.memoryTypeBits, properties), name);
 
-        assertm("can't allocate memory", vkAllocateMemory(device_, &allocate_info, nullptr, &memory) == VK_SUCCESS);
-
-        vkBindBufferMemory(device_, buffer, memory, 0);
+        vkBindBufferMemory(device_, buffer, memory.memory, memory.offset);
     }
 
     uint32_t findMemoryType(uint32_t typefilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties mem_properties;
-        vkGetPhysicalDeviceMemoryProperties(physical_device_, &mem_properties);
-
-        for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++) {
+        for (uint32_t i = 0; i < mem_properties_.memoryTypeCount; i++) {
             if ((typefilter & (1<<i)) &&
-                (mem_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+                (mem_properties_.memoryTypes[i].propertyFlags & properties) == properties) {
                 return i;
             }
         }
         throw std::runtime_error("no suitable memory type");
     }
 
+    // when window resized, only things depending on swapchain images are rebuilt,
+    // command buffers are recorded every frame so they pick up the new extent by themselves.
+    // pipeline uses dynamic viewport/scissor and render pass only depends on surface format, so we keep them
+    void recreateSwapchain() {
+        PROFILE_FUNCTION();
+        // minimized window has 0 size, wait untill it shows again
+        int w = 0, h = 0;
+        SDL_Vulkan_GetDrawableSize(window_, &w, &h);
+        while ((w == 0 || h == 0) && !ShouldClose()) {
+            SDL_WaitEvent(&event);
+            if (event.type == SDL_QUIT) {
+                Exit();
+            }
+            SDL_Vulkan_GetDrawableSize(window_, &w, &h);
+        }
+        if (ShouldClose()) {
+            return;
+        }
+        drawable_size_ = {static_cast<uint32_t>(w), static_cast<uint32_t>(h)};
+
+        vkDeviceWaitIdle(device_);
+
+        for (auto& framebuffer: framebuffers_) {
+            vkDestroyFramebuffer(device_, framebuffer, nullptr);
+        }
+        for (auto& view: imageviews_) {
+            vkDestroyImageView(device_, view, nullptr);
+        }
+
+        VkSwapchainKHR old_swapchain = swapchain_;
+        createSwapchain();
+        vkDestroySwapchainKHR(device_, old_swapchain, nullptr);
+
+        createImageViews();
+        createFramebuffer();
+
+        // image count may change, and no image is used by GPU now
+        images_inflight_.assign(images_.size(), VK_NULL_HANDLE);
+        framebuffer_resized_ = false;
+        Log("swapchain recreated, extent = (%u, %u)", swapchain_extent_.width, swapchain_extent_.height);
+    }
+
     void drawFrame() {
-        uint32_t image_idx;
-        vkAcquireNextImageKHR(device_, swapchain_, std::numeric_limits<uint64_t>::max(), image_avaliable_semaphore_, nullptr, &image_idx);
+        PROFILE_FUNCTION();
+        using Clock = std::chrono::steady_clock;
+
+        // wait untill GPU finished the frame which used these sync objects last time
+        auto wait_begin = Clock::now();
+        {
+            PROFILE_ZONE("wait frame fence");
+            vkWaitForFences(device_, 1, &inflight_fences_.at(current_frame_), VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+        double wait_ms = std::chrono::duration<double, std::milli>(Clock::now() - wait_begin).count();
+
+        // headless mode always draws on the only offscreen image
+        uint32_t image_idx = 0;
+        VkResult result = VK_SUCCESS;
+        if (!headless_) {
+            PROFILE_ZONE("acquire");
+            result = vkAcquireNextImageKHR(device_, swapchain_, std::numeric_limits<uint64_t>::max(), image_avaliable_semaphores_.at(current_frame_), nullptr, &image_idx);
+            // swapchain don't match the window any more, we can't draw on it.
+            // the fence is not reset yet, so returning here is safe
+            if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+                recreateSwapchain();
+                return;
+            }
+            assertm("can't acquire swapchain image", result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR);
+        }
+
+        // swapchain may give us an image which an older frame is still drawing on
+        if (images_inflight_.at(image_idx) != VK_NULL_HANDLE) {
+            PROFILE_ZONE("wait image fence");
+            wait_begin = Clock::now();
+            vkWaitForFences(device_, 1, &images_inflight_.at(image_idx), VK_TRUE, std::numeric_limits<uint64_t>::max());
+            wait_ms += std::chrono::duration<double, std::milli>(Clock::now() - wait_begin).count();
+        }
+        images_inflight_.at(image_idx) = inflight_fences_.at(current_frame_);
+
+        // GPU finished everything recorded from this frame's pool, reset it at once and record again
+        auto record_begin = Clock::now();
+        writeInstances(current_frame_);
+        if (culling_) {
+            writeCullCommand(current_frame_);
+        } else if (indirect_) {
+            writeIndirectCommands(current_frame_);
+        }
+        // the last use of this frame's particle buffer finished with the fence
+        bool particle_step = particles_.Enabled() && particles_.Async();
+        if (particle_step) {
+            particles_.SubmitStep(current_frame_, ParticleTimeStep);
+        }
+        if (objects_ && object_path_ == ObjectPath::DynamicUniform) {
+            writeObjectUniforms(current_frame_);
+        }
+        resetFrame(current_frame_);
+        VkCommandBuffer command_buffer = frame_pool_.Get(current_frame_);
+        recordFrame(command_buffer, current_frame_, image_idx);
+        double record_ms = std::chrono::duration<double, std::milli>(Clock::now() - record_begin).count();
 
         VkSubmitInfo submit_info = {};
         submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore wait_semaphores[] = {image_avaliable_semaphore_};
-        VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-
         // the submit will block untill wait_semaphores signalled;
-        submit_info.waitSemaphoreCount = 1;
-        submit_info.pWaitSemaphores = wait_semaphores;
+        // offscreen image is always avaliable, and nobody waits to present it
+        vector<VkSemaphore> wait_semaphores;
+        vector<VkPipelineStageFlags> wait_stages;
+        if (!headless_) {
+            wait_semaphores.push_back(image_avaliable_semaphores_.at(current_frame_));
+            wait_stages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+        }
+        // only vertex input reads the particles, the cull dispatch and quads don't need to wait
+        if (particle_step) {
+            wait_semaphores.push_back(particles_.Semaphore(current_frame_));
+            wait_stages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+        }
+        submit_info.waitSemaphoreCount = wait_semaphores.size();
+        submit_info.pWaitSemaphores = wait_semaphores.data();
 
         // the stage(situation) you want to wait the semaphore
-        submit_info.pWaitDstStageMask = wait_stages;
+        submit_info.pWaitDstStageMask = wait_stages.data();
 
         // the command you want to send
         submit_info.commandBufferCount = 1;
-        submit_info.pCommandBuffers = &command_buffers_.at(image_idx);
+        submit_info.pCommandBuffers = &command_buffer;
 
-        VkSemaphore signal_semaphores[] = {present_finish_semaphore_};
-        // the sumbit will signal the present_finish_semaphore_ when finish
-        submit_info.signalSemaphoreCount = 1;
+        VkSemaphore signal_semaphores[] = {present_finish_semaphores_.at(current_frame_)};
+        // the sumbit will signal the present finish semaphore when finish
+        submit_info.signalSemaphoreCount = headless_ ? 0 : 1;
         submit_info.pSignalSemaphores = signal_semaphores;
 
-        assertm("can't submit command", vkQueueSubmit(graphic_queue_, 1, &submit_info, nullptr) == VK_SUCCESS);
-
-        VkPresentInfoKHR present_info = {};
-        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        present_info.pImageIndices = &image_idx;
-        present_info.swapchainCount = 1;
-        present_info.pSwapchains = &swapchain_;
-        present_info.waitSemaphoreCount = 1;
-        present_info.pWaitSemaphores = signal_semaphores;
+        // the fence will be signaled when GPU finish this submit
+        vkResetFences(device_, 1, &inflight_fences_.at(current_frame_));
+        {
+            PROFILE_ZONE("submit");
+            assertm("can't submit command", vkQueueSubmit(graphic_queue_, 1, &submit_info, inflight_fences_.at(current_frame_)) == VK_SUCCESS);
+        }
+        gpu_profiler_.EndFrame(current_frame_);
+
+        // nothing to present in headless mode, the readback is already in command buffer
+        if (!headless_) {
+            PROFILE_ZONE("present");
+            VkPresentInfoKHR present_info = {};
+            present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            present_info.pImageIndices = &image_idx;
+            present_info.swapchainCount = 1;
+            present_info.pSwapchains = &swapchain_;
+            present_info.waitSemaphoreCount = 1;
+            present_info.pWaitSemaphores = signal_semaphores;
+
+            result = vkQueuePresentKHR(present_queue_, &present_info);
+            if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebuffer_resized_) {
+                recreateSwapchain();
+            } else {
+                assertm("queue present failed", result == VK_SUCCESS);
+            }
+        }
 
-        assertm("queue present failed", vkQueuePresentKHR(present_queue_, &present_info) == VK_SUCCESS);
+        current_frame_ = (current_frame_ + 1) % MaxFramesInFlight;
+        overlap_stats_.AddFrame(wait_ms, record_ms);
     }
 
     void quitVulkan() {
+        destroyParticleBuffers();
+        particles_.Destroy();
+        object_uniforms_.Destroy();
+        vkDestroyBuffer(device_, object_buffer_, nullptr);
+        allocator_.Free(object_memory_);
+        culler_.Destroy();
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            vkDestroyBuffer(device_, culled_buffers_.at(i), nullptr);
+            allocator_.Free(culled_memories_.at(i));
+        }
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            vkDestroyBuffer(device_, indirect_buffers_.at(i), nullptr);
+            allocator_.Free(indirect_memories_.at(i));
+        }
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            vkDestroyBuffer(device_, instance_buffers_.at(i), nullptr);
+            allocator_.Free(instance_memories_.at(i));
+        }
         vkDestroyBuffer(device_, index_buffer_, nullptr);
-        vkFreeMemory(device_, index_buf_memory_, nullptr);
+        allocator_.Free(index_buf_memory_);
         vkDestroyBuffer(device_, vertex_buffer_, nullptr);
-        vkFreeMemory(device_, vertex_buf_memory_, nullptr);
-        vkDestroySemaphore(device_, image_avaliable_semaphore_, nullptr);
-        vkDestroySemaphore(device_, present_finish_semaphore_, nullptr);
-        vkFreeCommandBuffers(device_, commandpool_, command_buffers_.size(), command_buffers_.data());
+        allocator_.Free(vertex_buf_memory_);
+        upload_queue_.Destroy();
+        staging_ring_.Destroy();
+        vkDestroyBuffer(device_, staging_buffer_, nullptr);
+        allocator_.Free(staging_memory_);
+        for (int i = 0; i < MaxFramesInFlight; i++) {
+            vkDestroySemaphore(device_, image_avaliable_semaphores_.at(i), nullptr);
+            vkDestroySemaphore(device_, present_finish_semaphores_.at(i), nullptr);
+            vkDestroyFence(device_, inflight_fences_.at(i), nullptr);
+        }
+        jobs_.Destroy();
+        frame_pool_.Destroy();
+        // pools stop growing once every frame found enough of them
+        Log("descriptors: %zu set layouts, %zu pools", descriptor_layouts_.LayoutCount(), descriptor_allocator_.PoolCount());
+        descriptor_allocator_.Destroy();
+        gpu_profiler_.Destroy();
         for (auto& framebuffer: framebuffers_) {
             vkDestroyFramebuffer(device_, framebuffer, nullptr);
         }
         vkDestroyPipeline(device_, pipeline_, nullptr);
+        vkDestroyPipeline(device_, particle_pipeline_, nullptr);
+        vkDestroyPipeline(device_, object_pipeline_, nullptr);
+        vkDestroyPipeline(device_, object_push_pipeline_, nullptr);
+        if (bindless_supported_) {
+            vkDestroyPipeline(device_, bindless_pipeline_, nullptr);
+            vkDestroyPipelineLayout(device_, bindless_pipeline_layout_, nullptr);
+            bindless_.Destroy();
+        }
+        shader_loader_.Destroy();
+        pipeline_cache_.Destroy();
         vkDestroyRenderPass(device_, renderpass_, nullptr);
         vkDestroyPipelineLayout(device_, pipeline_layout_, nullptr);
+        descriptor_layouts_.Destroy();
         for (auto& view: imageviews_) {
             vkDestroyImageView(device_, view, nullptr);
         }
-        vkDestroySwapchainKHR(device_, swapchain_, nullptr);
+        if (headless_) {
+            offscreen_.Destroy();
+        } else {
+            vkDestroySwapchainKHR(device_, swapchain_, nullptr);
+        }
         vkDestroyCommandPool(device_, commandpool_, nullptr);
+        allocator_.PrintStats();
+        allocator_.Destroy();
         vkDestroyDevice(device_, nullptr);
-        vkDestroySurfaceKHR(instance_, surface_, nullptr);
+        if (!headless_) {
+            vkDestroySurfaceKHR(instance_, surface_, nullptr);
+        }
         vkDestroyInstance(instance_, nullptr);
     }
 };
 
 int main(int argc, char** argv) {
-    App app;
+    // --headless N: render N frames into an offscreen image without window, save the last one to headless.ppm, then quit.
+    // exit code is 1 if nothing was drawn
+    // --trace FILE: record CPU zones from startup, write them as Chrome trace JSON to FILE at exit.
+    // these two are needed before App starts
+    uint32_t headless_frames = 0;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (string(argv[i]) == "--headless") {
+            headless_frames = std::atoi(argv[i + 1]);
+        } else if (string(argv[i]) == "--trace") {
+            CpuProfiler::Get().Enable(argv[i + 1]);
+        }
+    }
+
+    App app(headless_frames > 0);
     app.SetTitle("vertex buffers");
+
+    // --uncapped: don't wait between frames
+    // --fps N: sleep and spin to N frames per second
+    // --bench-upload: compare blocking copies with upload queue, then quit
+    // --bench-record: record 1 to 10000 draws per frame directly and indirectly, print recording time, then quit
+    // --indirect: draw the draw list with indirect draws
+    // --cull-scene N: N quads on a grid bigger than the window, a compute shader culls them and feeds an indirect draw
+    // --threads N: record draws with N worker threads
+    // --bench-threads: record 100000 draws with 1 to all worker threads, then quit
+    // --gpu-csv FILE: write GPU time of render pass and draws of every frame to FILE
+    // --instances N: draw N quads with one instanced draw
+    // --bench-instancing: draw 100000 quads one draw each, then in one instanced draw, print both times, then quit
+    // --objects N: draw N quads one draw each, transforms come from a dynamic uniform buffer
+    // --push-objects N: the same, but transforms come from push constants
+    // --bindless-objects N: the same, but transforms come from instance buffers in the bindless table
+    // --bench-objects: draw 10000 quads with dynamic uniform offsets, push constants and bindless, print each time, then quit
+    // --particles N: simulate N particles with a compute shader, draw them as points
+    // --bench-particles N: simulate N particles for 1000 steps without drawing, print particles per second, then quit
+    bool bench_upload = false;
+    bool bench_record = false;
+    bool bench_threads = false;
+    bool bench_instancing = false;
+    bool bench_objects = false;
+    uint32_t bench_particles = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--uncapped") {
+            app.SetPaceMode(PaceMode::Uncapped, 0);
+        } else if (arg == "--fps" && i + 1 < argc) {
+            app.SetPaceMode(PaceMode::TargetFPS, std::atof(argv[++i]));
+        } else if (arg == "--bench-upload") {
+            bench_upload = true;
+        } else if (arg == "--bench-record") {
+            bench_record = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            app.SetRecordThreads(std::atoi(argv[++i]));
+        } else if (arg == "--bench-threads") {
+            bench_threads = true;
+        } else if (arg == "--gpu-csv" && i + 1 < argc) {
+            app.OpenGpuCSV(argv[++i]);
+        } else if (arg == "--instances" && i + 1 < argc) {
+            app.DrawInstancedGrid(std::atoi(argv[++i]));
+        } else if (arg == "--bench-instancing") {
+            bench_instancing = true;
+        } else if (arg == "--indirect") {
+            app.SetIndirect(true);
+        } else if (arg == "--cull-scene" && i + 1 < argc) {
+            app.CullScene(std::atoi(argv[++i]));
+        } else if (arg == "--objects" && i + 1 < argc) {
+            app.DrawObjects(std::atoi(argv[++i]));
+        } else if (arg == "--push-objects" && i + 1 < argc) {
+            app.DrawObjects(std::atoi(argv[++i]), ObjectPath::PushConstant);
+        } else if (arg == "--bindless-objects" && i + 1 < argc) {
+            app.DrawObjects(std::atoi(argv[++i]), ObjectPath::Bindless);
+        } else if (arg == "--bench-objects") {
+            bench_objects = true;
+        } else if (arg == "--particles" && i + 1 < argc) {
+            app.EnableParticles(std::atoi(argv[++i]));
+        } else if (arg == "--bench-particles" && i + 1 < argc) {
+            bench_particles = std::atoi(argv[++i]);
+        }
+    }
+
+    if (bench_upload) {
+        app.BenchmarkUpload(10000);
+        return 0;
+    }
+    if (bench_record) {
+        app.BenchmarkRecording(10000);
+        return 0;
+    }
+    if (bench_threads) {
+        app.BenchmarkRecordingThreads(100000);
+        return 0;
+    }
+    if (bench_instancing) {
+        app.BenchmarkInstancing(100000);
+        return 0;
+    }
+    if (bench_objects) {
+        app.BenchmarkObjects(10000);
+        return 0;
+    }
+    if (bench_particles > 0) {
+        app.BenchmarkParticles(bench_particles, 1000);
+        return 0;
+    }
+    if (headless_frames > 0) {
+        return app.RunHeadless(headless_frames, "headless.ppm") ? 0 : 1;
+    }
+
     app.Run();
     return 0;
 }
@@ -0,0 +1,32 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects: enable
+
+layout (location = 0) in vec2 inPos;
+layout (location = 1) in vec3 inColor;
+
+// must match InstanceData in index_buffer.cpp
+struct Instance {
+    vec4 transform;     // xy is offset, zw is scale
+    vec3 color;
+    float padding;
+};
+
+// binding 0 of the bindless table, its size depends on device limits and is set when creating the pipeline
+layout (constant_id = 0) const uint BufferCount = 1024;
+layout (std430, set = 0, binding = 0) readonly buffer Instances {
+    Instance data[];
+} buffers[BufferCount];
+
+// the same index for the whole draw, so dynamic indexing is enough
+layout (push_constant) uniform Params {
+    uint buffer;
+    uint instance;
+} params;
+
+layout (location = 0) out vec3 fragColor;
+
+void main() {
+    Instance instance = buffers[params.buffer].data[params.instance];
+    gl_Position = vec4(inPos * instance.transform.zw + instance.transform.xy, 0.0, 1.0);
+    fragColor = inColor * instance.color;
+}
@@ -0,0 +1,16 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects: enable
+
+layout (location = 0) in vec2 inPos;
+layout (location = 1) in vec3 inColor;
+
+// per instance
+layout (location = 2) in vec4 inTransform;     // xy is offset, zw is scale
+layout (location = 3) in vec3 inInstanceColor;
+
+layout (location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = vec4(inPos * inTransform.zw + inTransform.xy, 0.0, 1.0);
+    fragColor = inColor * inInstanceColor;
+}
@@ -0,0 +1,20 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects: enable
+
+layout (location = 0) in vec2 inPos;
+layout (location = 1) in vec3 inColor;
+
+// per object, bound with a dynamic offset into the frame's uniform buffer.
+// must match ObjectUniform in index_buffer.cpp
+layout (set = 0, binding = 0) uniform Object {
+    mat4 model;
+    vec4 color;
+    uint material;      // not used yet
+} object;
+
+layout (location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = object.model * vec4(inPos, 0.0, 1.0);
+    fragColor = inColor * object.color.rgb;
+}
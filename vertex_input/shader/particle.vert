@@ -0,0 +1,15 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects: enable
+
+// same locations as shader.vert, but read from the particle buffer
+layout (location = 0) in vec2 inPos;
+layout (location = 1) in vec3 inColor;
+
+layout (location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = vec4(inPos, 0.0, 1.0);
+    // points must write their size, otherwise it is undefined
+    gl_PointSize = 2.0;
+    fragColor = inColor;
+}
@@ -0,0 +1,20 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects: enable
+
+layout (location = 0) in vec2 inPos;
+layout (location = 1) in vec3 inColor;
+
+// per draw, pushed into the command buffer before each draw.
+// same as object.vert's uniform, must match ObjectUniform in index_buffer.cpp
+layout (push_constant) uniform Object {
+    mat4 model;
+    vec4 color;
+    uint material;      // not used yet
+} object;
+
+layout (location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = object.model * vec4(inPos, 0.0, 1.0);
+    fragColor = inColor * object.color.rgb;
+}
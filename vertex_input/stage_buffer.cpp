@@ -1,6 +1,5 @@
 #include <string>
 #include <vector>
-#include <iostream>
 #include <optional>
 #include <array>
 #include <set>
@@ -14,10 +13,10 @@
 #include "glm/glm.hpp"
 
 #include "log.hpp"
+#include "frame_pacer.hpp"
+#include "memory_allocator.hpp"
 #include "vulkan/vulkan_core.h"
 
-using std::cout;
-using std::endl;
 using std::vector;
 using std::optional;
 using std::string;
@@ -116,8 +115,9 @@ class App {
         while (!ShouldClose()) {
             pollEvent();
             drawFrame();
-            SDL_Delay(60);
+            pacer_.Wait();
         }
+        pacer_.Report();
         vkDeviceWaitIdle(device_);
     }
 
@@ -125,6 +125,7 @@ class App {
     SDL_Window* window_;
     SDL_Event event;
     bool should_close_;
+    FramePacer pacer_;
 
     void initSDL() {
         SDL_Init(SDL_INIT_EVERYTHING);
@@ -167,8 +168,9 @@ class App {
     vector<VkFramebuffer> framebuffers_;
     VkSemaphore image_avaliable_semaphore_;
     VkSemaphore present_finish_semaphore_;
+    MemoryAllocator allocator_;
     VkBuffer vertex_buffer_;
-    VkDeviceMemory vertex_buf_memory_;
+    Allocation vertex_buf_memory_;
 
     void initVulkan() {
         createInstance();
@@ -179,6 +181,8 @@ class App {
         Log("create surface");
         createLogicDevice();
         Log("create logic device");
+        allocator_.Init(physical_device_, device_);
+        Log("init memory allocator");
         createCommandPool();
         Log("create command pool");
         createSwapchain();
@@ -222,9 +226,9 @@ class App {
         // NOTIC: if you don't have this extension, validation layer will not show error untill you create logic device.
         extensions.push_back("VK_KHR_get_physical_device_properties2");
 
-        cout << "SDL provide extensions:" << endl;
+        LogDebug("SDL provide extensions:");
         for (const char* extension: extensions) {
-            cout<< "\t" << extension << endl;
+            LogDebug("\t%s", extension);
         }
 
         VkInstanceCreateInfo instance_create_info = {};
@@ -280,9 +284,9 @@ class App {
         vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
         vector<VkExtensionProperties> properties(count);
         vkEnumerateInstanceExtensionProperties(nullptr, &count, properties.data());
-        cout << "all supported extensions:" << endl;
+        LogDebug("all supported extensions:");
         for (auto& property: properties) {
-            cout << "\t" << property.extensionName << endl;
+            LogDebug("\t%s", property.extensionName);
         }
     }
 
@@ -292,9 +296,9 @@ class App {
         vector<VkLayerProperties> properties(count);
         vkEnumerateInstanceLayerProperties(&count, properties.data());
 
-        cout << "all supported validation layers:" << endl;
+        LogDebug("all supported validation layers:");
         for (auto& property: properties) {
-            cout << "\t" << property.layerName << endl;
+            LogDebug("\t%s", property.layerName);
         }
     }
 
@@ -312,19 +316,17 @@ class App {
     void printPhysicalDeviceInfo(VkPhysicalDevice& device) {
         VkPhysicalDeviceProperties property;
         vkGetPhysicalDeviceProperties(physical_device_, &property);
-        cout << "physic device property:" << endl;
-        cout << "\tname: " << property.deviceName << endl;
-        cout << "\tintergrated?: " << (property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU?"YES":"NO") << endl;
-        printf("\tapi version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.apiVersion),
-                VK_VERSION_MINOR(property.apiVersion),
-                VK_VERSION_PATCH(property.apiVersion)
-                );
-        printf("\tdriver version: %d.%d.%d\n",
-                VK_VERSION_MAJOR(property.driverVersion),
-                VK_VERSION_MINOR(property.driverVersion),
-                VK_VERSION_PATCH(property.driverVersion)
-                );
+        Log("physic device property:");
+        Log("\tname: %s", property.deviceName);
+        Log("\tintergrated?: %s", property.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ? "YES" : "NO");
+        Log("\tapi version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.apiVersion),
+            VK_VERSION_MINOR(property.apiVersion),
+            VK_VERSION_PATCH(property.apiVersion));
+        Log("\tdriver version: %d.%d.%d",
+            VK_VERSION_MAJOR(property.driverVersion),
+            VK_VERSION_MINOR(property.driverVersion),
+            VK_VERSION_PATCH(property.driverVersion));
     }
 
     void createSurface() {
@@ -407,10 +409,10 @@ class App {
         create_info.imageFormat = format.format;
 
         if (format.format == VK_FORMAT_B8G8R8A8_SRGB) {
-            cout << "surface format: BGRA8888 SRGB" << endl;
+            Log("surface format: BGRA8888 SRGB");
         }
         if (format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-            cout << "surface color space: SRGB" << endl;
+            Log("surface color space: SRGB");
         }
 
         auto capabilities = getSurfaceCapabilities();
@@ -418,7 +420,7 @@ class App {
         if (image_count < capabilities.minImageCount || image_count > capabilities.maxImageCount) {
             image_count = capabilities.minImageCount;
         }
-        cout << "image_count = " << image_count << endl;
+        Log("image_count = %u", image_count);
         create_info.minImageCount = image_count;
 
         VkExtent2D extent = {WindowWidth, WindowHeight};
@@ -429,7 +431,7 @@ class App {
             extent.height = capabilities.maxImageExtent.height;
         }
         create_info.imageExtent = extent;
-        printf("extent = (%d, %d)\n", extent.width, extent.height);
+        Log("extent = (%u, %u)", extent.width, extent.height);
 
         auto family_idx = getQueueFamilyIdx();
         uint32_t idices[] = {family_idx.graphic_queue_idx.value(), family_idx.present_queue_idx.value()};
@@ -459,7 +461,7 @@ class App {
         images_.resize(count);
         vkGetSwapchainImagesKHR(device_, swapchain_, &count, images_.data());
 
-        printf("got %d images\n", count);
+        Log("got %u images", count);
     }
 
     VkSurfaceFormatKHR getSurfaceFormat() {
@@ -793,26 +795,24 @@ class App {
         VkDeviceSize size = sizeof(Vertex)*TriangleVertices.size();
 
         VkBuffer staging_buffer;
-        VkDeviceMemory staging_buf_memory;
+        Allocation staging_buf_memory;
         createBuffer(size,
                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                     staging_buffer, staging_buf_memory);
+                     staging_buffer, staging_buf_memory, "vertex staging buffer");
 
-        void* data;
-        vkMapMemory(device_, staging_buf_memory, 0, size, 0, &data);
-        memcpy(data, TriangleVertices.data(), size);
-        vkUnmapMemory(device_, staging_buf_memory);
+        // host visible memory is always mapped by allocator
+        memcpy(staging_buf_memory.mapped, TriangleVertices.data(), size);
 
         createBuffer(size,
                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                     vertex_buffer_, vertex_buf_memory_);
+                     vertex_buffer_, vertex_buf_memory_, "vertex buffer");
 
         copyBuffer(staging_buffer, vertex_buffer_, size);
 
         vkDestroyBuffer(device_, staging_buffer, nullptr);
-        vkFreeMemory(device_, staging_buf_memory, nullptr);
+        allocator_.Free(staging_buf_memory);
     }
 
     void copyBuffer(VkBuffer& src, VkBuffer& dst, VkDeviceSize size) {
@@ -849,7 +849,7 @@ class App {
         vkFreeCommandBuffers(device_, commandpool_, 1, &buffer);
     }
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory) {
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& memory, const char* name = "") {
         VkBufferCreateInfo create_info = {};
         create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         create_info.usage = usage;
@@ -861,14 +861,10 @@ class App {
         VkMemoryRequirements requirements = {};
         vkGetBufferMemoryRequirements(device_, buffer, &requirements);
 
-        VkMemoryAllocateInfo allocate_info = {};
-        allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocate_info.allocationSize = requirements.size;
-        allocate_info.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+        // take a piece of a big memory block instead of calling vkAllocateMemory for each buffer
+        memory = allocator_.Allocate(requirements, findMemoryType(requirements.memoryTypeBits, properties), name);
 
-        assertm("can't allocate memory", vkAllocateMemory(device_, &allocate_info, nullptr, &memory) == VK_SUCCESS);
-
-        vkBindBufferMemory(device_, buffer, memory, 0);
+        vkBindBufferMemory(device_, buffer, memory.memory, memory.offset);
     }
 
     uint32_t findMemoryType(uint32_t typefilter, VkMemoryPropertyFlags properties) {
@@ -921,11 +917,16 @@ class App {
         present_info.pWaitSemaphores = signal_semaphores;
 
         assertm("queue present failed", vkQueuePresentKHR(present_queue_, &present_info) == VK_SUCCESS);
+
+        // there are no fences and only one pair of semaphores, so wait untill the frame is presented.
+        // this is what keeps the next acquire from reusing the semaphores while they are still pending,
+        // the frame pacer alone doesn't. index_buffer.cpp uses a fence for each frame in flight instead
+        vkQueueWaitIdle(present_queue_);
     }
 
     void quitVulkan() {
         vkDestroyBuffer(device_, vertex_buffer_, nullptr);
-        vkFreeMemory(device_, vertex_buf_memory_, nullptr);
+        allocator_.Free(vertex_buf_memory_);
         vkDestroySemaphore(device_, image_avaliable_semaphore_, nullptr);
         vkDestroySemaphore(device_, present_finish_semaphore_, nullptr);
         vkFreeCommandBuffers(device_, commandpool_, command_buffers_.size(), command_buffers_.data());
@@ -940,6 +941,8 @@ class App {
         }
         vkDestroySwapchainKHR(device_, swapchain_, nullptr);
         vkDestroyCommandPool(device_, commandpool_, nullptr);
+        allocator_.PrintStats();
+        allocator_.Destroy();
         vkDestroyDevice(device_, nullptr);
         vkDestroySurfaceKHR(instance_, surface_, nullptr);
         vkDestroyInstance(instance_, nullptr);